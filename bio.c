@@ -1,6 +1,6 @@
 // Buffer cache.
 //
-// The buffer cache is a linked list of buf structures holding
+// The buffer cache is a hash table of buf structures holding
 // cached copies of disk block contents.  Caching disk blocks
 // in memory reduces the number of disk reads and also provides
 // a synchronization point for disk blocks used by multiple processes.
@@ -17,79 +17,251 @@
 // * B_VALID: the buffer data has been read from the disk.
 // * B_DIRTY: the buffer data has been modified
 //     and needs to be written to disk.
+//
+// Each buffer is on the list of the hash bucket for its
+// (dev, blockno), and each bucket has its own lock, so finding
+// a cached block and releasing it take only that bucket's lock.
+// A buffer records when it was last released; to cache a new
+// block, bget() recycles the unused buffer released longest
+// ago, taking it from whichever bucket it is in.  bcache.lock
+// serializes the recycling.
+//
+// Buffers come in pages from kalloc(), BPP to a page.  The
+// cache starts with 1/64 of memory (at least NBUF buffers, at
+// most MAXNBUF) and grows, rather than recycling, while it is
+// smaller than 1/16 of memory (and MAXNBUF) and free memory
+// isn't short.  When ualloc() runs out
+// of memory it calls bshrink() to give unused pages back.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "meminfo.h"
 
-struct {
+#define NBUCKET 13
+#define BPP     6    // buffers per page
+#define NSHRINK 8    // most pages bshrink() frees at once
+#define BHASH(dev, blockno)  (((dev) + (blockno)) % NBUCKET)
+
+struct bucket {
   struct spinlock lock;
-  struct buf buf[NBUF];
+  struct buf head;         // list of buffers, through prev/next
+};
 
-  // Linked list of all buffers, through prev/next.
-  // head.next is most recently used.
-  struct buf head;
+// A page of buffers: their headers, then their data.
+struct bpage {
+  struct bpage *next;
+  struct buf buf[BPP];
+  uchar data[BPP][BSIZE];
+};
+
+struct {
+  struct spinlock lock;    // held while recycling, growing or shrinking
+  struct bpage *pages;     // all pages of buffers
+  int npage;
+  struct bucket bucket[NBUCKET];
 } bcache;
 
+// Add b to the list of bucket k.  Caller must hold k->lock.
+static void
+blink(struct bucket *k, struct buf *b)
+{
+  b->next = k->head.next;
+  b->prev = &k->head;
+  k->head.next->prev = b;
+  k->head.next = b;
+}
+
+// Remove b from its bucket's list.  Caller must hold the bucket's lock.
+static void
+bunlink(struct buf *b)
+{
+  b->next->prev = b->prev;
+  b->prev->next = b->next;
+}
+
+// Add a page of buffers to the cache, all unused.
+// Caller must hold bcache.lock, or be binit().
+static int
+bgrow(void)
+{
+  struct bpage *pg;
+  struct bucket *k;
+  struct buf *b;
+  int i;
+
+  if((pg = (struct bpage*)kalloc()) == 0)
+    return -1;
+  memset(pg->buf, 0, sizeof(pg->buf));
+  // Unused buffers hold block 0 of device 0.
+  k = &bcache.bucket[BHASH(0, 0)];
+  acquire(&k->lock);
+  for(i = 0; i < BPP; i++){
+    b = &pg->buf[i];
+    initsleeplock(&b->lock, "buffer");
+    b->data = pg->data[i];
+    blink(k, b);
+  }
+  release(&k->lock);
+  pg->next = bcache.pages;
+  bcache.pages = pg;
+  bcache.npage++;
+  return 0;
+}
+
+// Should bget() grow the cache instead of recycling a buffer?
+// Caller must hold bcache.lock.
+static int
+bcangrow(void)
+{
+  struct meminfo m;
+
+  if((bcache.npage+1)*BPP > MAXNBUF)
+    return 0;
+  kmemstat(&m);
+  return bcache.npage < m.total/16 && m.free > m.total/8;
+}
+
 void
 binit(void)
 {
-  struct buf *b;
+  struct bucket *k;
+  struct meminfo m;
+  int n;
 
+  if(sizeof(struct bpage) > PGSIZE)
+    panic("binit: bpage");
   initlock(&bcache.lock, "bcache");
+  for(k = bcache.bucket; k < bcache.bucket+NBUCKET; k++){
+    initlock(&k->lock, "bcache.bucket");
+    k->head.prev = &k->head;
+    k->head.next = &k->head;
+  }
 
 //PAGEBREAK!
-  // Create linked list of buffers
-  bcache.head.prev = &bcache.head;
-  bcache.head.next = &bcache.head;
-  for(b = bcache.buf; b < bcache.buf+NBUF; b++){
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    initsleeplock(&b->lock, "buffer");
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
-  }
+  kmemstat(&m);
+  n = m.total/64 * BPP;
+  if(n < NBUF)
+    n = NBUF;
+  if(n > MAXNBUF)
+    n = MAXNBUF;
+  while(bcache.npage*BPP < n)
+    if(bgrow() < 0)
+      panic("binit");
 }
 
-// Look through buffer cache for block on device dev.
-// If not found, allocate a buffer.
-// In either case, return locked buffer.
+// Find the buffer for block on device dev in bucket k and take
+// a reference to it.  Caller must hold k->lock.
 static struct buf*
-bget(uint dev, uint blockno)
+blookup(struct bucket *k, uint dev, uint blockno)
 {
   struct buf *b;
 
-  acquire(&bcache.lock);
-
-  // Is the block already cached?
-  for(b = bcache.head.next; b != &bcache.head; b = b->next){
+  for(b = k->head.next; b != &k->head; b = b->next){
     if(b->dev == dev && b->blockno == blockno){
       b->refcnt++;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
       return b;
     }
   }
+  return 0;
+}
+
+// Look through buffer cache for block on device dev.
+// If not found, allocate a buffer, and set *fresh.
+// In either case, return the buffer with a reference
+// for the caller, but not locked.
+static struct buf*
+bfind(uint dev, uint blockno, int *fresh)
+{
+  struct buf *b, *lru;
+  struct bucket *k, *lruk, *bk;
+  int found;
+
+  // Is the block already cached?
+  *fresh = 0;
+  bk = &bcache.bucket[BHASH(dev, blockno)];
+  acquire(&bk->lock);
+  b = blookup(bk, dev, blockno);
+  release(&bk->lock);
+  if(b)
+    return b;
+
+  // Not cached.  Only recyclers add blocks to buckets, so
+  // once we hold bcache.lock no one else can cache this one;
+  // check that no one did while we weren't holding it.
+  acquire(&bcache.lock);
+  acquire(&bk->lock);
+  b = blookup(bk, dev, blockno);
+  release(&bk->lock);
+  if(b){
+    release(&bcache.lock);
+    return b;
+  }
 
-  // Not cached; recycle an unused buffer.
+  // Recycle the unused buffer released longest ago, keeping its
+  // bucket locked so that no one takes a reference to it.
   // Even if refcnt==0, B_DIRTY indicates a buffer is in use
   // because log.c has modified it but not yet committed it.
-  for(b = bcache.head.prev; b != &bcache.head; b = b->prev){
-    if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0) {
-      b->dev = dev;
-      b->blockno = blockno;
-      b->flags = 0;
-      b->refcnt = 1;
-      release(&bcache.lock);
-      acquiresleep(&b->lock);
-      return b;
+  // New buffers from bgrow() have never been released, so
+  // they go first.
+  if(bcangrow())
+    bgrow();
+again:
+  lru = 0;
+  lruk = 0;
+  for(k = bcache.bucket; k < bcache.bucket+NBUCKET; k++){
+    acquire(&k->lock);
+    found = 0;
+    for(b = k->head.next; b != &k->head; b = b->next){
+      if(b->refcnt == 0 && (b->flags & B_DIRTY) == 0 &&
+         (lru == 0 || b->lastuse < lru->lastuse)){
+        lru = b;
+        found = 1;
+      }
     }
+    if(found){
+      if(lruk)
+        release(&lruk->lock);
+      lruk = k;
+    } else
+      release(&k->lock);
+  }
+  if(lru == 0){
+    // All in use; grow even if memory is short.
+    if(bgrow() < 0)
+      panic("bget: no buffers");
+    goto again;
   }
-  panic("bget: no buffers");
+  bunlink(lru);
+  release(&lruk->lock);
+
+  lru->dev = dev;
+  lru->blockno = blockno;
+  lru->flags = 0;
+  lru->refcnt = 1;
+  acquire(&bk->lock);
+  blink(bk, lru);
+  release(&bk->lock);
+  release(&bcache.lock);
+  *fresh = 1;
+  return lru;
+}
+
+// Return a locked buffer for block on device dev.
+static struct buf*
+bget(uint dev, uint blockno)
+{
+  struct buf *b;
+  int fresh;
+
+  b = bfind(dev, blockno, &fresh);
+  acquiresleep(&b->lock);
+  return b;
 }
 
 // Return a locked buf with the contents of the indicated block.
@@ -115,30 +287,147 @@ bwrite(struct buf *b)
   iderw(b);
 }
 
-// Release a locked buffer.
-// Move to the head of the MRU list.
+// Asynchronous I/O.  bwrite_async() and bprefetch() start a
+// request and return without waiting for the disk.  The
+// buffer stays locked, and the caller must bwait() for the
+// request before using or releasing it, unless the done
+// function it passed releases it (see bdone()).  done, if not
+// 0, is called when the request finishes, perhaps from the
+// disk interrupt handler, so it must not sleep.
+
+// Start writing b's contents to disk.  Must be locked.
 void
-brelse(struct buf *b)
+bwrite_async(struct buf *b, void (*done)(struct buf*))
 {
   if(!holdingsleep(&b->lock))
-    panic("brelse");
+    panic("bwrite_async");
+  b->flags |= B_DIRTY;
+  b->done = done;
+  idesubmit(b);
+}
 
-  releasesleep(&b->lock);
+// Wait for the asynchronous request on locked buffer b.
+void
+bwait(struct buf *b)
+{
+  idewaitbuf(b);
+}
 
-  acquire(&bcache.lock);
+// Drop a reference to b, stamping it with when it was last
+// used (for bget()) if no one else is waiting for it.
+static void
+bput(struct buf *b, uint stamp)
+{
+  struct bucket *k;
+
+  k = &bcache.bucket[BHASH(b->dev, b->blockno)];
+  acquire(&k->lock);
   b->refcnt--;
   if (b->refcnt == 0) {
     // no one is waiting for it.
-    b->next->prev = b->prev;
-    b->prev->next = b->next;
-    b->next = bcache.head.next;
-    b->prev = &bcache.head;
-    bcache.head.next->prev = b;
-    bcache.head.next = b;
+    b->lastuse = stamp;
   }
-  
+  release(&k->lock);
+}
+
+// Release a locked buffer, as brelse() or bforget().
+static void
+brelease(struct buf *b, uint stamp)
+{
+  if(!holdingsleep(&b->lock))
+    panic("brelse");
+
+  releasesleep(&b->lock);
+  bput(b, stamp);
+}
+
+// Release a locked buffer.
+void
+brelse(struct buf *b)
+{
+  brelease(b, ticks);
+}
+
+// Release a locked buffer that won't be wanted again soon,
+// such as file data that the page cache now holds, so that
+// it is the first to be recycled.
+void
+bforget(struct buf *b)
+{
+  brelease(b, 0);
+}
+
+// Start reading block on device dev into the cache, if it
+// isn't there already, without waiting for the disk.
+void
+bprefetch(uint dev, uint blockno)
+{
+  struct buf *b;
+  int fresh;
+
+  b = bfind(dev, blockno, &fresh);
+  if(!fresh){
+    bput(b, b->lastuse);
+    return;
+  }
+  // No one else can have a fresh buffer, so this won't sleep.
+  acquiresleep(&b->lock);
+  b->done = bdone;
+  idesubmit(b);
+}
+
+// A done function for asynchronous I/O that releases b when
+// the request finishes.  It may run in an interrupt handler,
+// so it doesn't check who holds the lock.
+void
+bdone(struct buf *b)
+{
+  releasesleep(&b->lock);
+  bput(b, ticks);
+}
+
+// Give up to NSHRINK pages of unused buffers back to the page
+// allocator, keeping at least NBUF buffers.  Called when memory
+// is short.  Returns the number of pages freed.
+int
+bshrink(void)
+{
+  struct bpage *pg, **pp;
+  int i, n;
+
+  acquire(&bcache.lock);
+  for(i = 0; i < NBUCKET; i++)
+    acquire(&bcache.bucket[i].lock);
+  n = 0;
+  pp = &bcache.pages;
+  while((pg = *pp) != 0 && n < NSHRINK && (bcache.npage-1)*BPP >= NBUF){
+    for(i = 0; i < BPP; i++)
+      if(pg->buf[i].refcnt != 0 || (pg->buf[i].flags & B_DIRTY))
+        break;
+    if(i < BPP){
+      pp = &pg->next;
+      continue;
+    }
+    for(i = 0; i < BPP; i++)
+      bunlink(&pg->buf[i]);
+    *pp = pg->next;
+    bcache.npage--;
+    kfree((char*)pg);
+    n++;
+  }
+  for(i = NBUCKET-1; i >= 0; i--)
+    release(&bcache.bucket[i].lock);
+  release(&bcache.lock);
+  return n;
+}
+
+// Fill in the buffer cache's part of m.
+void
+bstat(struct meminfo *m)
+{
+  acquire(&bcache.lock);
+  m->bcache = bcache.npage;
   release(&bcache.lock);
 }
 //PAGEBREAK!
 // Blank page.
-
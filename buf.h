@@ -4,10 +4,13 @@ struct buf {
   uint blockno;
   struct sleeplock lock;
   uint refcnt;
-  struct buf *prev; // LRU cache list
+  uint lastuse;     // ticks when last released
+  struct buf *prev; // hash bucket list
   struct buf *next;
   struct buf *qnext; // disk queue
-  uchar data[BSIZE];
+  uint qtime;       // ticks when queued for the disk
+  void (*done)(struct buf*);  // called when asynchronous I/O finishes
+  uchar *data;      // BSIZE bytes
 };
 #define B_VALID 0x2  // buffer has been read from disk
 #define B_DIRTY 0x4  // buffer needs to be written to disk
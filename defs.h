@@ -10,12 +10,23 @@ struct sleeplock;
 struct stat;
 struct superblock;
 struct uproc;
+struct shm;
+struct vma;
+struct meminfo;
+struct pcidev;
 
 // bio.c
 void            binit(void);
 struct buf*     bread(uint, uint);
 void            brelse(struct buf*);
+void            bforget(struct buf*);
+void            bprefetch(uint, uint);
+void            bdone(struct buf*);
+void            bwrite_async(struct buf*, void(*)(struct buf*));
+void            bwait(struct buf*);
 void            bwrite(struct buf*);
+int             bshrink(void);
+void            bstat(struct meminfo*);
 
 // console.c
 void            consoleinit(void);
@@ -28,6 +39,7 @@ void            do_shutdown(void);
 
 // exec.c
 int             exec(char*, char**);
+int             execinto(struct proc*, char*, char**);
 
 // file.c
 struct file*    filealloc(void);
@@ -54,14 +66,20 @@ int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, char*, uint, uint);
+int             readibuf(struct inode*, char*, uint, uint);
+void            ireadahead(struct inode*, uint, uint);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
 
 
 // ide.c
+extern int      ideirq;
 void            ideinit(void);
 void            ideintr(void);
 void            iderw(struct buf*);
+uint            idesize(uint);
+void            idesubmit(struct buf*);
+void            idewaitbuf(struct buf*);
 
 // ioapic.c
 void            ioapicenable(int irq, int cpu);
@@ -70,9 +88,19 @@ void            ioapicinit(void);
 
 // kalloc.c
 char*           kalloc(void);
+char*           kzalloc(void);
+int             kzfill(void);
 void            kfree(char*);
+void            kfreen(char**, int);
 void            kinit1(void*, void*);
 void            kinit2(void*, void*);
+void            kmemstat(struct meminfo*);
+void            kref(char*);
+int             krefcount(char*);
+char*           lpalloc(void);
+void            lpfree(char*);
+void            lpinit(void*);
+void            lpref(char*);
 
 // kbd.c
 void            kbdintr(void);
@@ -89,13 +117,38 @@ void            microdelay(int);
 // log.c
 void            initlog(int dev);
 void            log_write(struct buf*);
-void            begin_op();
+void            log_data(struct buf*);
+void            log_free(uint);
+int             log_freed(uint);
+int             log_reuse(void);
+void            begin_op(int);
+void            begin_opdata(int, int);
 void            end_op();
+void            logsync(void);
+void            logkick(void);
 
 // mp.c
 extern int      ismp;
 void            mpinit(void);
 
+// pcache.c
+void            pcinit(void);
+void            pcinval(struct inode*);
+char*           pcpage(struct inode*, uint, int*);
+int             pchas(struct inode*, uint);
+void            pcput(struct inode*);
+int             pcread(struct inode*, char*, uint, uint);
+void            pcref(struct inode*);
+int             pcshrink(void);
+void            pcstat(struct meminfo*);
+void            pcwrite(struct inode*, uint, char*, char*, uint);
+
+// pci.c
+int             pcifind(int, int, int, int, struct pcidev*);
+void            pcienable(struct pcidev*);
+uint            pciread(struct pcidev*, uint);
+void            pciwrite(struct pcidev*, uint, uint);
+
 // picirq.c
 void            picenable(int);
 void            picinit(void);
@@ -113,14 +166,19 @@ void            exit(void);
 int             fork(void);
 int             growproc(int);
 int             kill(int);
+struct proc*    kthread(char*, void (*)(void));
 struct cpu*     mycpu(void);
 struct proc*    myproc();
 void            pinit(void);
 void            procdump(void);
+void            procmemstat(struct meminfo*);
+void            reaper(void);
 void            scheduler(void) __attribute__((noreturn));
 void            sched(void);
 void            setproc(struct proc*);
+char*           swapvictim(uint);
 void            sleep(void*, struct spinlock*);
+int             spawn(char*, char**, int*);
 void            userinit(void);
 int             wait(void);
 void            wakeup(void*);
@@ -134,6 +192,15 @@ void            printListStats(void);
 void            promoteProcs(void);
 #endif  //CS333_P4
 
+// swap.c
+void            swapdump(void);
+void            swapdup(uint);
+void            swapfree(uint);
+void            swapinit(void);
+void            swapread(uint, char*);
+void            swapstat(struct meminfo*);
+char*           ualloc(int);
+
 // swtch.S
 void            swtch(struct context**, struct context*);
 
@@ -146,6 +213,16 @@ void            release(struct spinlock*);
 void            pushcli(void);
 void            popcli(void);
 
+// shm.c
+void            shmdup(struct shm*);
+int             shmget(int, uint);
+void            shminit(void);
+struct shm*     shmlookup(int, uint*);
+char*           shmpage(struct shm*, int);
+void            shmput(struct shm*);
+int             shmrm(int);
+void            shmstat(struct meminfo*);
+
 // sleeplock.c
 void            acquiresleep(struct sleeplock*);
 void            releasesleep(struct sleeplock*);
@@ -164,6 +241,7 @@ char*           strncpy(char*, const char*, int);
 // syscall.c
 int             argint(int, int*);
 int             argptr(int, char**, int);
+int             argwptr(int, char**, int);
 int             argstr(int, char**);
 int             fetchint(uint, int*);
 int             fetchstr(uint, char**);
@@ -195,11 +273,23 @@ int             deallocuvm(pde_t*, uint, uint);
 void            freevm(pde_t*);
 void            inituvm(pde_t*, char*, uint);
 int             loaduvm(pde_t*, char*, struct inode*, uint, uint);
-pde_t*          copyuvm(pde_t*, uint);
+pde_t*          copyuvm(pde_t*);
 void            switchuvm(struct proc*);
 void            switchkvm(void);
 int             copyout(pde_t*, uint, void*, uint);
 void            clearpteu(pde_t *pgdir, char *uva);
+int             pagefault(struct proc*, uint, int);
+int             touchuvm(struct proc*, uint, uint, int);
+void            vmadup(struct vma*, struct vma*);
+void            vmafree(pde_t*, struct vma*);
+int             vmamap(struct proc*, uint, uint, int, int, struct inode*, uint);
+int             vmaoverlap(struct vma*, uint, uint);
+int             vmashm(struct proc*, struct shm*, uint);
+int             vmashmdt(struct proc*, uint);
+int             vmaunmap(struct proc*, uint, uint);
+char*           vmclock(pde_t*, uint*, uint);
+void            vmstat(struct meminfo*);
+void            vmusage(pde_t*, uint*, uint*, uint*);
 
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
@@ -6,21 +6,34 @@
 #include "defs.h"
 #include "x86.h"
 #include "elf.h"
+#include "mman.h"
 
 
 int
 exec(char *path, char **argv)
+{
+  return execinto(myproc(), path, argv);
+}
+
+// Replace the user memory of p with the program in path,
+// started with arguments argv, which must be in the current
+// process's memory.  p is either the current process, for
+// exec(), or a new one that has no user memory yet, for
+// spawn().  Returns -1 and leaves p alone on failure.
+int
+execinto(struct proc *p, char *path, char **argv)
 {
   char *s, *last;
-  int i, off;
+  int i, n, off;
   uint argc, sz, sp, ustack[3+MAXARG+1];
   struct elfhdr elf;
   struct inode *ip;
   struct proghdr ph;
+  struct vma vma[NVMA], tmp;
   pde_t *pgdir, *oldpgdir;
-  struct proc *curproc = myproc();
 
-  begin_op();
+  memset(vma, 0, sizeof(vma));
+  begin_op(OP_IPUT);
 
   if((ip = namei(path)) == 0){
     end_op();
@@ -41,8 +54,10 @@ exec(char *path, char **argv)
   if((pgdir = setupkvm()) == 0)
     goto bad;
 
-  // Load program into memory.
+  // Record the loadable segments.  Nothing is read yet:
+  // pagefault() brings each page in from ip on first use.
   sz = 0;
+  n = 0;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
@@ -52,12 +67,26 @@ exec(char *path, char **argv)
       goto bad;
     if(ph.vaddr + ph.memsz < ph.vaddr)
       goto bad;
-    if((sz = allocuvm(pgdir, sz, ph.vaddr + ph.memsz)) == 0)
+    if(ph.vaddr + ph.memsz >= KERNBASE)
       goto bad;
     if(ph.vaddr % PGSIZE != 0)
       goto bad;
-    if(loaduvm(pgdir, (char*)ph.vaddr, ip, ph.off, ph.filesz) < 0)
+    if(n >= NVMA)
       goto bad;
+    vma[n].start = ph.vaddr;
+    vma[n].end = ph.vaddr + ph.memsz;
+    vma[n].off = ph.off;
+    vma[n].filesz = ph.filesz;
+    vma[n].flags = MAP_PRIVATE;
+    vma[n].perm = PTE_W|PTE_U;
+    n++;
+    if(ph.vaddr + ph.memsz > sz)
+      sz = ph.vaddr + ph.memsz;
+  }
+  // Each region holds its own reference to the executable.
+  for(i = 0; i < n; i++){
+    vma[i].ip = idup(ip);
+    pcref(ip);
   }
   iunlockput(ip);
   end_op();
@@ -94,15 +123,23 @@ exec(char *path, char **argv)
   for(last=s=path; *s; s++)
     if(*s == '/')
       last = s+1;
-  safestrcpy(curproc->name, last, sizeof(curproc->name));
+  safestrcpy(p->name, last, sizeof(p->name));
 
   // Commit to the user image.
-  oldpgdir = curproc->pgdir;
-  curproc->pgdir = pgdir;
-  curproc->sz = sz;
-  curproc->tf->eip = elf.entry;  // main
-  curproc->tf->esp = sp;
-  switchuvm(curproc);
+  oldpgdir = p->pgdir;
+  p->pgdir = pgdir;
+  p->sz = sz;
+  p->tf->eip = elf.entry;  // main
+  p->tf->esp = sp;
+  for(i = 0; i < NVMA; i++){
+    tmp = p->vma[i];
+    p->vma[i] = vma[i];
+    vma[i] = tmp;
+  }
+  if(oldpgdir == 0)
+    return 0;
+  switchuvm(p);
+  vmafree(oldpgdir, vma);  // the old image's regions
   freevm(oldpgdir);
   return 0;
 
@@ -113,5 +150,6 @@ bad:
     iunlockput(ip);
     end_op();
   }
+  vmafree(0, vma);
   return -1;
 }
@@ -5,11 +5,14 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
 #include "fs.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "file.h"
 
+#define RAMAX (4*PGSIZE)  // most fileread() reads ahead
+
 struct devsw devsw[NDEV];
 struct {
   struct spinlock lock;
@@ -73,7 +76,7 @@ fileclose(struct file *f)
   if(ff.type == FD_PIPE)
     pipeclose(ff.pipe, ff.writable);
   else if(ff.type == FD_INODE){
-    begin_op();
+    begin_op(OP_IPUT);
     iput(ff.ip);
     end_op();
   }
@@ -104,8 +107,17 @@ fileread(struct file *f, char *addr, int n)
     return piperead(f->pipe, addr, n);
   if(f->type == FD_INODE){
     ilock(f->ip);
-    if((r = readi(f->ip, addr, f->off, n)) > 0)
+    if((r = readi(f->ip, addr, f->off, n)) > 0){
+      // Read ahead, further each time, while reads are sequential.
+      if(f->off != f->raoff)
+        f->rawin = 0;
+      else if(f->rawin < RAMAX)
+        f->rawin = f->rawin ? 2*f->rawin : PGSIZE;
       f->off += r;
+      f->raoff = f->off;
+      if(f->rawin)
+        ireadahead(f->ip, f->off, f->rawin);
+    }
     iunlock(f->ip);
     return r;
   }
@@ -125,19 +137,17 @@ filewrite(struct file *f, char *addr, int n)
     return pipewrite(f->pipe, addr, n);
   if(f->type == FD_INODE){
     // write a few blocks at a time to avoid exceeding
-    // the maximum log transaction size, including
-    // i-node, indirect block, allocation blocks,
-    // and 2 blocks of slop for non-aligned writes.
+    // the maximum log transaction size (see MAXOPWRITE).
     // this really belongs lower down, since writei()
     // might be writing a device like the console.
-    int max = ((MAXOPBLOCKS-1-1-2) / 2) * 512;
+    int max = MAXOPWRITE;
     int i = 0;
     while(i < n){
       int n1 = n - i;
       if(n1 > max)
         n1 = max;
 
-      begin_op();
+      begin_opdata(OP_WRITE, (n1 + BSIZE-1)/BSIZE + 1);
       ilock(f->ip);
       if ((r = writei(f->ip, addr + i, f->off, n1)) > 0)
         f->off += r;
@@ -6,6 +6,8 @@ struct file {
   struct pipe *pipe;
   struct inode *ip;
   uint off;
+  uint raoff;  // where a sequential read would continue
+  uint rawin;  // bytes to read ahead; 0 if reads aren't sequential
 };
 
 
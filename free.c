@@ -0,0 +1,32 @@
+// Print memory usage and paging activity.
+#include "types.h"
+#include "user.h"
+#include "meminfo.h"
+
+#define KB(pages) ((pages) * 4)
+
+int
+main(void)
+{
+  struct meminfo m;
+
+  if(meminfo(&m) < 0){
+    printf(2, "free: meminfo failed\n");
+    exit();
+  }
+  printf(1, "\ttotal\tused\tfree\t(KB)\n");
+  printf(1, "Mem:\t%d\t%d\t%d\n",
+         KB(m.total), KB(m.total - m.free), KB(m.free));
+  printf(1, "Large:\t%d\t%d\t%d\n",
+         KB(m.lptotal*1024), KB((m.lptotal - m.lpfree)*1024), KB(m.lpfree*1024));
+  printf(1, "Swap:\t%d\t%d\t%d\n",
+         KB(m.swaptotal), KB(m.swapused), KB(m.swaptotal - m.swapused));
+  printf(1, "\nzeroed %d KB, kernel stacks %d KB, page tables %d KB\n",
+         KB(m.zero), KB(m.kstack), KB(m.pgtab));
+  printf(1, "page cache %d KB, buffer cache %d KB, shared memory %d KB\n",
+         KB(m.pcache), KB(m.bcache), KB(m.shm));
+  printf(1, "faults: %d minor, %d major, %d copy-on-write\n",
+         m.minflt, m.majflt, m.cowflt);
+  printf(1, "swap: %d pages out, %d in\n", m.swapout, m.swapin);
+  exit();
+}
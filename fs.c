@@ -38,41 +38,52 @@ readsb(int dev, struct superblock *sb)
   brelse(bp);
 }
 
-// Zero a block.
+// Zero a block, which will hold a regular file's data if
+// data is set.
 static void
-bzero(int dev, int bno)
+bzero(int dev, int bno, int data)
 {
   struct buf *bp;
 
   bp = bread(dev, bno);
   memset(bp->data, 0, BSIZE);
-  log_write(bp);
+  if(data)
+    log_data(bp);
+  else
+    log_write(bp);
   brelse(bp);
 }
 
 // Blocks.
 
-// Allocate a zeroed disk block.
+// Allocate a zeroed disk block, for a regular file's data
+// if data is set.  Blocks the open transaction freed are not
+// free yet on disk, so take one of those only if there is no
+// other; see log_free().
 static uint
-balloc(uint dev)
+balloc(uint dev, int data)
 {
-  int b, bi, m;
+  int b, bi, m, reuse;
   struct buf *bp;
 
   bp = 0;
-  for(b = 0; b < sb.size; b += BPB){
-    bp = bread(dev, BBLOCK(b, sb));
-    for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
-      m = 1 << (bi % 8);
-      if((bp->data[bi/8] & m) == 0){  // Is block free?
+  for(reuse = 0; reuse < 2; reuse++){
+    for(b = 0; b < sb.size; b += BPB){
+      bp = bread(dev, BBLOCK(b, sb));
+      for(bi = 0; bi < BPB && b + bi < sb.size; bi++){
+        m = 1 << (bi % 8);
+        if((bp->data[bi/8] & m) != 0)  // Is block free?
+          continue;
+        if(log_freed(b + bi) && (!reuse || log_reuse() < 0))
+          continue;
         bp->data[bi/8] |= m;  // Mark block in use.
         log_write(bp);
         brelse(bp);
-        bzero(dev, b + bi);
+        bzero(dev, b + bi, data);
         return b + bi;
       }
+      brelse(bp);
     }
-    brelse(bp);
   }
   panic("balloc: out of blocks");
 }
@@ -92,6 +103,7 @@ bfree(int dev, uint b)
     panic("freeing free block");
   bp->data[bi/8] &= ~m;
   log_write(bp);
+  log_free(b);
   brelse(bp);
 }
 
@@ -378,7 +390,7 @@ bmap(struct inode *ip, uint bn)
 
   if(bn < NDIRECT){
     if((addr = ip->addrs[bn]) == 0)
-      ip->addrs[bn] = addr = balloc(ip->dev);
+      ip->addrs[bn] = addr = balloc(ip->dev, ip->type == T_FILE);
     return addr;
   }
   bn -= NDIRECT;
@@ -386,11 +398,11 @@ bmap(struct inode *ip, uint bn)
   if(bn < NINDIRECT){
     // Load indirect block, allocating if necessary.
     if((addr = ip->addrs[NDIRECT]) == 0)
-      ip->addrs[NDIRECT] = addr = balloc(ip->dev);
+      ip->addrs[NDIRECT] = addr = balloc(ip->dev, 0);
     bp = bread(ip->dev, addr);
     a = (uint*)bp->data;
     if((addr = a[bn]) == 0){
-      a[bn] = addr = balloc(ip->dev);
+      a[bn] = addr = balloc(ip->dev, ip->type == T_FILE);
       log_write(bp);
     }
     brelse(bp);
@@ -400,6 +412,29 @@ bmap(struct inode *ip, uint bn)
   panic("bmap: out of range");
 }
 
+// Return the disk block address of the nth block in inode ip,
+// or 0 if there is no such block.
+static uint
+bmaplookup(struct inode *ip, uint bn)
+{
+  uint addr;
+  struct buf *bp;
+
+  if(bn < NDIRECT)
+    return ip->addrs[bn];
+  bn -= NDIRECT;
+
+  if(bn < NINDIRECT){
+    if((addr = ip->addrs[NDIRECT]) == 0)
+      return 0;
+    bp = bread(ip->dev, addr);
+    addr = ((uint*)bp->data)[bn];
+    brelse(bp);
+    return addr;
+  }
+  return 0;
+}
+
 // Truncate inode (discard contents).
 // Only called when the inode has no links
 // to it (no directory entries referring to it)
@@ -433,6 +468,7 @@ itrunc(struct inode *ip)
 
   ip->size = 0;
   iupdate(ip);
+  pcinval(ip);
 }
 
 // Copy stat information from inode.
@@ -449,13 +485,11 @@ stati(struct inode *ip, struct stat *st)
 
 //PAGEBREAK!
 // Read data from inode.
+// Regular files are read through the page cache (pcache.c).
 // Caller must hold ip->lock.
 int
 readi(struct inode *ip, char *dst, uint off, uint n)
 {
-  uint tot, m;
-  struct buf *bp;
-
   if(ip->type == T_DEV){
     if(ip->major < 0 || ip->major >= NDEV || !devsw[ip->major].read)
       return -1;
@@ -467,15 +501,57 @@ readi(struct inode *ip, char *dst, uint off, uint n)
   if(off + n > ip->size)
     n = ip->size - off;
 
+  if(ip->type == T_FILE)
+    return pcread(ip, dst, off, n);
+  return readibuf(ip, dst, off, n);
+}
+
+// Read data from inode through the buffer cache.  The blocks
+// of a regular file are on their way into the page cache,
+// so they are released with bforget() to leave metadata cached.
+// Caller must hold ip->lock and have checked the range.
+int
+readibuf(struct inode *ip, char *dst, uint off, uint n)
+{
+  uint tot, m;
+  struct buf *bp;
+
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
     memmove(dst, bp->data + off%BSIZE, m);
-    brelse(bp);
+    if(ip->type == T_FILE)
+      bforget(bp);
+    else
+      brelse(bp);
   }
   return n;
 }
 
+// Start reading the blocks that hold the n bytes of regular
+// file ip at off into the buffer cache, without waiting,
+// skipping pages that the page cache already holds.
+// For sequential reads; see fileread().
+// Caller must hold ip->lock.
+void
+ireadahead(struct inode *ip, uint off, uint n)
+{
+  uint a, end, bn, addr;
+
+  if(ip->type != T_FILE || off >= ip->size)
+    return;
+  end = off + n;
+  if(end > ip->size || end < off)
+    end = ip->size;
+  for(a = PGROUNDDOWN(off); a < end; a += PGSIZE){
+    if(pchas(ip, a))
+      continue;
+    for(bn = a/BSIZE; bn < (a+PGSIZE)/BSIZE && bn*BSIZE < end; bn++)
+      if((addr = bmaplookup(ip, bn)) != 0)
+        bprefetch(ip->dev, addr);
+  }
+}
+
 // PAGEBREAK!
 // Write data to inode.
 // Caller must hold ip->lock.
@@ -500,8 +576,14 @@ writei(struct inode *ip, char *src, uint off, uint n)
     bp = bread(ip->dev, bmap(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
     memmove(bp->data + off%BSIZE, src, m);
-    log_write(bp);
-    brelse(bp);
+    if(ip->type == T_FILE){
+      log_data(bp);
+      pcwrite(ip, off, (char*)bp->data + off%BSIZE, src, m);
+      bforget(bp);
+    } else {
+      log_write(bp);
+      brelse(bp);
+    }
   }
 
   if(n > 0 && off > ip->size){
@@ -1,4 +1,11 @@
-// Simple PIO-based (non-DMA) IDE driver code.
+// IDE driver code.
+//
+// Disk 1 moves data by bus-master DMA when the PCI IDE
+// controller supports it (the PIIX that QEMU emulates does):
+// the controller copies straight between the disk and the
+// buffers, described to it by a table of physical regions.
+// Otherwise, and for disk 0, the CPU moves the data itself
+// with PIO.
 
 #include "types.h"
 #include "defs.h"
@@ -12,6 +19,7 @@
 #include "sleeplock.h"
 #include "fs.h"
 #include "buf.h"
+#include "pci.h"
 
 #define SECTOR_SIZE   512
 #define IDE_BSY       0x80
@@ -23,17 +31,206 @@
 #define IDE_CMD_WRITE 0x30
 #define IDE_CMD_RDMUL 0xc4
 #define IDE_CMD_WRMUL 0xc5
+#define IDE_CMD_IDENT 0xec
+#define IDE_CMD_SETMUL 0xc6
+#define IDE_CMD_RDDMA 0xc8
+#define IDE_CMD_WRDMA 0xca
 
-// idequeue points to the buf now being read/written to the disk.
-// idequeue->qnext points to the next buf to be processed.
-// You must hold idelock while manipulating queue.
+// Bus master registers, for the primary channel.
+#define BM_CMD        0   // command
+#define BM_STATUS     2   // status
+#define BM_PRDT       4   // physical address of region table
+#define BM_CMD_START  0x01
+#define BM_CMD_READ   0x08  // device to memory
+#define BM_ST_ERR     0x02
+#define BM_ST_INTR    0x04
+
+#define MAXMULT       128  // most sectors in one READ/WRITE MULTIPLE
+
+// idequeue points to the bufs now being read/written to the disk,
+// linked through qnext: consecutive blocks, moved by one command.
+// Other requests wait on a list kept by the I/O scheduler.
+// You must hold idelock while manipulating the queues.
 
 static struct spinlock idelock;
 static struct buf *idequeue;
 
+int ideirq = IRQ_IDE;    // for trap()
+
 static int havedisk1;
+static uint disk1size;  // in sectors
+static int disk1mult;   // sectors per READ/WRITE MULTIPLE, or 0
+
+// A physical region descriptor: one piece of a DMA transfer.
+// The table must not cross a 64KB boundary, nor may a region,
+// so a buffer that does takes two regions.
+struct prd {
+  uint addr;
+  ushort n;      // bytes
+  ushort flags;
+};
+#define PRD_EOT 0x8000  // last region
+
+static uint idebm;      // bus master I/O base; 0 if no DMA
+static int idedma;      // the current request uses DMA
+static struct prd prdt[2*MAXMULT] __attribute__((aligned(sizeof(struct prd)*2*MAXMULT)));
 static void idestart(struct buf*);
 
+//PAGEBREAK!
+// I/O schedulers.  add() puts a request on the waiting list;
+// next() takes off the one to start when the disk is free.
+//
+// fifo serves requests in the order they arrive.  cscan serves
+// them in order of block number, sweeping up the disk and
+// then starting again from the bottom, so that requests for
+// nearby blocks go together and the head seeks less.  deadline
+// is cscan, except that a request that has waited too long goes
+// next, so that a stream of requests ahead of the head can't
+// starve one behind it.  Reads expire sooner than writes,
+// since someone is usually waiting for them.
+
+#define READ_EXPIRE   5   // ticks
+#define WRITE_EXPIRE 50
+
+struct iosched {
+  void (*add)(struct buf*);
+  struct buf* (*next)(void);
+};
+
+static struct buf *idewaiting;  // requests not yet started
+static uint idelastdev;         // last request started
+static uint idelastblock;
+
+// Is block b1 of dev d1 before block b2 of dev d2 in disk order?
+static int
+idebefore(uint d1, uint b1, uint d2, uint b2)
+{
+  return d1 < d2 || (d1 == d2 && b1 < b2);
+}
+
+static void
+fifoadd(struct buf *b)
+{
+  struct buf **pp;
+
+  for(pp=&idewaiting; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
+    ;
+  *pp = b;
+}
+
+static struct buf*
+fifonext(void)
+{
+  struct buf *b;
+
+  if((b = idewaiting) != 0)
+    idewaiting = b->qnext;
+  return b;
+}
+
+// Keep idewaiting sorted in disk order.
+static void
+cscanadd(struct buf *b)
+{
+  struct buf **pp;
+
+  for(pp=&idewaiting; *pp; pp=&(*pp)->qnext)
+    if(idebefore(b->dev, b->blockno, (*pp)->dev, (*pp)->blockno))
+      break;
+  b->qnext = *pp;
+  *pp = b;
+}
+
+// Take the first request at or past the last one started,
+// or the first of all if there is none.
+static struct buf*
+cscannext(void)
+{
+  struct buf **pp, *b;
+
+  for(pp=&idewaiting; *pp; pp=&(*pp)->qnext)
+    if(!idebefore((*pp)->dev, (*pp)->blockno, idelastdev, idelastblock))
+      break;
+  if(*pp == 0)
+    pp = &idewaiting;
+  if((b = *pp) != 0)
+    *pp = b->qnext;
+  return b;
+}
+
+// As cscannext(), but first take the oldest request that has
+// waited too long, if there is one.
+static struct buf*
+deadlinenext(void)
+{
+  struct buf **pp, **oldest, *b;
+  uint expire;
+
+  oldest = 0;
+  for(pp=&idewaiting; *pp; pp=&(*pp)->qnext){
+    expire = ((*pp)->flags & B_DIRTY) ? WRITE_EXPIRE : READ_EXPIRE;
+    if(ticks - (*pp)->qtime >= expire &&
+       (oldest == 0 || (*pp)->qtime < (*oldest)->qtime))
+      oldest = pp;
+  }
+  if(oldest){
+    b = *oldest;
+    *oldest = b->qnext;
+    return b;
+  }
+  return cscannext();
+}
+
+static struct iosched scheds[] = {
+  { fifoadd,  fifonext },      // fifo
+  { cscanadd, cscannext },     // cscan
+  { cscanadd, deadlinenext },  // deadline
+};
+
+#if defined(IOSCHED_FIFO)
+static struct iosched *iosched = &scheds[0];
+#elif defined(IOSCHED_CSCAN)
+static struct iosched *iosched = &scheds[1];
+#else
+static struct iosched *iosched = &scheds[2];
+#endif
+
+// Start the next waiting request, if any, on the idle disk,
+// along with waiting requests of the same kind for the blocks
+// after it, as many as the disk can move per interrupt.
+// Caller must hold idelock.
+static void
+idenext(void)
+{
+  struct buf *b, *p, **pp;
+  int n, max;
+
+  if((b = iosched->next()) == 0)
+    return;
+  b->qnext = 0;
+  max = 1;
+  if(b->dev == 1 && idebm != 0)
+    max = MAXMULT / (BSIZE/SECTOR_SIZE);
+  else if(b->dev == 1 && disk1mult > 0)
+    max = disk1mult / (BSIZE/SECTOR_SIZE);
+  for(p = b, n = 1; n < max; n++){
+    for(pp=&idewaiting; *pp; pp=&(*pp)->qnext)
+      if((*pp)->dev == p->dev && (*pp)->blockno == p->blockno+1 &&
+         ((*pp)->flags & B_DIRTY) == (b->flags & B_DIRTY))
+        break;
+    if(*pp == 0)
+      break;
+    p->qnext = *pp;
+    *pp = (*pp)->qnext;
+    p = p->qnext;
+    p->qnext = 0;
+  }
+  idequeue = b;
+  idelastdev = p->dev;
+  idelastblock = p->blockno;
+  idestart(b);
+}
+
 // Wait for IDE disk to become ready.
 static int
 idewait(int checkerr)
@@ -51,6 +248,7 @@ void
 ideinit(void)
 {
   int i;
+  struct pcidev pd;
 
   initlock(&idelock, "ide");
   ioapicenable(IRQ_IDE, ncpu - 1);
@@ -65,35 +263,113 @@ ideinit(void)
     }
   }
 
+  // Ask disk 1 how big it is.  Words 60-61 of the
+  // IDENTIFY data are the number of addressable sectors.
+  // The low byte of word 47 is the most sectors it can move
+  // per interrupt with READ/WRITE MULTIPLE; if that's more
+  // than one, turn multiple mode on with that many.
+  if(havedisk1){
+    uint id[SECTOR_SIZE/4];
+    int mult;
+
+    outb(0x1f7, IDE_CMD_IDENT);
+    if(idewait(1) >= 0){
+      insl(0x1f0, id, SECTOR_SIZE/4);
+      disk1size = id[30];
+      mult = (id[23] >> 16) & 0xff;
+      for(i = MAXMULT; i > mult; i /= 2)
+        ;
+      if(i > 1){
+        outb(0x1f2, i);
+        outb(0x1f7, IDE_CMD_SETMUL);
+        if(idewait(1) >= 0)
+          disk1mult = i;
+      }
+
+      // Use DMA if the disk can (bit 8 of word 49) and there
+      // is a bus-mastering IDE controller.  Its BAR 4 holds the
+      // bus master registers.
+      if(((id[24] >> 16) & (1<<8)) &&
+         pcifind(PCI_ANY, PCI_ANY, 0x01, 0x01, &pd) == 0 &&
+         (pd.progif & 0x80) && (pd.bar[4] & PCI_BAR_IO)){
+        pcienable(&pd);
+        idebm = PCI_BAR_IOADDR(pd.bar[4]);
+      }
+    }
+  }
+
   // Switch back to disk 0.
   outb(0x1f6, 0xe0 | (0<<4));
 }
 
-// Start the request for b.  Caller must hold idelock.
+// Number of blocks on disk dev, or 0 if unknown.
+uint
+idesize(uint dev)
+{
+  if(dev != 1)
+    return 0;
+  return disk1size / (BSIZE/SECTOR_SIZE);
+}
+
+// Start the request for the bufs linked from b through qnext.
+// Caller must hold idelock.
 static void
 idestart(struct buf *b)
 {
+  struct buf *p;
+  int nblock;
+
   if(b == 0)
     panic("idestart");
-  if(b->blockno >= FSSIZE)
+  nblock = 0;
+  for(p = b; p; p = p->qnext)
+    nblock++;
+  if(b->blockno + nblock > FSSIZE+SWAPSIZE)
     panic("incorrect blockno");
   int sector_per_block =  BSIZE/SECTOR_SIZE;
   int sector = b->blockno * sector_per_block;
-  int read_cmd = (sector_per_block == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
-  int write_cmd = (sector_per_block == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
+  int nsector = nblock * sector_per_block;
+  int read_cmd = (nsector == 1) ? IDE_CMD_READ :  IDE_CMD_RDMUL;
+  int write_cmd = (nsector == 1) ? IDE_CMD_WRITE : IDE_CMD_WRMUL;
 
   if (sector_per_block > 7) panic("idestart");
 
+  // Describe the buffers to the bus master.
+  idedma = b->dev == 1 && idebm != 0;
+  if(idedma){
+    int i = 0;
+    uint pa, n, len;
+    for(p = b; p; p = p->qnext){
+      pa = V2P(p->data);
+      for(n = BSIZE; n > 0; n -= len, pa += len, i++){
+        len = 0x10000 - (pa & 0xffff);  // to the next 64KB boundary
+        if(len > n)
+          len = n;
+        prdt[i].addr = pa;
+        prdt[i].n = len;
+        prdt[i].flags = 0;
+      }
+    }
+    prdt[i-1].flags = PRD_EOT;
+    outl(idebm+BM_PRDT, V2P(prdt));
+    outb(idebm+BM_CMD, (b->flags & B_DIRTY) ? 0 : BM_CMD_READ);
+    outb(idebm+BM_STATUS, inb(idebm+BM_STATUS) | BM_ST_ERR | BM_ST_INTR);
+  }
+
   idewait(0);
   outb(0x3f6, 0);  // generate interrupt
-  outb(0x1f2, sector_per_block);  // number of sectors
+  outb(0x1f2, nsector);  // number of sectors
   outb(0x1f3, sector & 0xff);
   outb(0x1f4, (sector >> 8) & 0xff);
   outb(0x1f5, (sector >> 16) & 0xff);
   outb(0x1f6, 0xe0 | ((b->dev&1)<<4) | ((sector>>24)&0x0f));
-  if(b->flags & B_DIRTY){
+  if(idedma){
+    outb(0x1f7, (b->flags & B_DIRTY) ? IDE_CMD_WRDMA : IDE_CMD_RDDMA);
+    outb(idebm+BM_CMD, inb(idebm+BM_CMD) | BM_CMD_START);
+  } else if(b->flags & B_DIRTY){
     outb(0x1f7, write_cmd);
-    outsl(0x1f0, b->data, BSIZE/4);
+    for(p = b; p; p = p->qnext)
+      outsl(0x1f0, p->data, BSIZE/4);
   } else {
     outb(0x1f7, read_cmd);
   }
@@ -103,7 +379,9 @@ idestart(struct buf *b)
 void
 ideintr(void)
 {
-  struct buf *b;
+  struct buf *b, *next;
+  void (*done)(struct buf*);
+  uchar st;
 
   // First queued buffer is the active request.
   acquire(&idelock);
@@ -112,33 +390,60 @@ ideintr(void)
     release(&idelock);
     return;
   }
-  idequeue = b->qnext;
+  idequeue = 0;
 
-  // Read data if needed.
-  if(!(b->flags & B_DIRTY) && idewait(1) >= 0)
-    insl(0x1f0, b->data, BSIZE/4);
+  if(idedma){
+    // Stop the bus master and check that all went well.
+    // If not, go back to PIO and do the requests again.
+    outb(idebm+BM_CMD, 0);
+    st = inb(idebm+BM_STATUS);
+    outb(idebm+BM_STATUS, st | BM_ST_ERR | BM_ST_INTR);
+    if((st & BM_ST_ERR) || idewait(1) < 0){
+      cprintf("ide: DMA failed; using PIO\n");
+      idebm = 0;
+      for(; b; b = next){
+        next = b->qnext;
+        b->qnext = 0;
+        iosched->add(b);
+      }
+      idenext();
+      release(&idelock);
+      return;
+    }
+  } else if(!(b->flags & B_DIRTY) && idewait(1) >= 0){
+    // Read data if needed.
+    for(next = b; next; next = next->qnext)
+      insl(0x1f0, next->data, BSIZE/4);
+  }
 
-  // Wake process waiting for this buf.
-  b->flags |= B_VALID;
-  b->flags &= ~B_DIRTY;
-  wakeup(b);
+  // Wake processes waiting for these bufs, and tell whoever
+  // started them.
+  for(; b; b = next){
+    next = b->qnext;
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    done = b->done;
+    b->done = 0;
+    wakeup(b);
+    if(done)
+      done(b);
+  }
 
   // Start disk on next buf in queue.
-  if(idequeue != 0)
-    idestart(idequeue);
+  idenext();
 
   release(&idelock);
 }
 
 //PAGEBREAK!
-// Sync buf with disk.
+// Start syncing buf with disk, and return without waiting.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
+// When the request finishes, ideintr() wakes up idewaitbuf()
+// and calls b->done(b), if set.  b stays locked throughout.
 void
-iderw(struct buf *b)
+idesubmit(struct buf *b)
 {
-  struct buf **pp;
-
   if(!holdingsleep(&b->lock))
     panic("iderw: buf not locked");
   if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
@@ -148,21 +453,33 @@ iderw(struct buf *b)
 
   acquire(&idelock);  //DOC:acquire-lock
 
-  // Append b to idequeue.
+  // Hand b to the scheduler.
   b->qnext = 0;
-  for(pp=&idequeue; *pp; pp=&(*pp)->qnext)  //DOC:insert-queue
-    ;
-  *pp = b;
+  b->qtime = ticks;
+  iosched->add(b);
 
   // Start disk if necessary.
-  if(idequeue == b)
-    idestart(b);
+  if(idequeue == 0)
+    idenext();
+
+  release(&idelock);
+}
 
-  // Wait for request to finish.
+// Wait for the request for b to finish.
+void
+idewaitbuf(struct buf *b)
+{
+  acquire(&idelock);
   while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
     sleep(b, &idelock);
   }
-
-
   release(&idelock);
 }
+
+// Sync buf with disk, waiting for it to finish.
+void
+iderw(struct buf *b)
+{
+  idesubmit(b);
+  idewaitbuf(b);
+}
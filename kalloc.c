@@ -8,6 +8,7 @@
 #include "memlayout.h"
 #include "mmu.h"
 #include "spinlock.h"
+#include "meminfo.h"
 
 void freerange(void *vstart, void *vend);
 extern char end[]; // first address after kernel loaded from ELF file
@@ -21,6 +22,11 @@ struct {
   struct spinlock lock;
   int use_lock;
   struct run *freelist;
+  struct run *zerolist;       // free pages already filled with zeros
+  int nzero;                  // length of zerolist
+  int npage;                  // pages given to the allocator
+  int nfree;                  // free pages, zeroed or not
+  uchar ref[PHYSTOP/PGSIZE];  // references to each physical page
 } kmem;
 
 // Initialization happens in two phases.
@@ -48,37 +54,120 @@ freerange(void *vstart, void *vend)
 {
   char *p;
   p = (char*)PGROUNDUP((uint)vstart);
-  for(; p + PGSIZE <= (char*)vend; p += PGSIZE)
+  for(; p + PGSIZE <= (char*)vend; p += PGSIZE){
+    kmem.ref[V2P(p)/PGSIZE] = 1;
+    kmem.npage++;
     kfree(p);
+  }
 }
 //PAGEBREAK: 21
-// Free the page of physical memory pointed at by v,
-// which normally should have been returned by a
-// call to kalloc().  (The exception is when
-// initializing the allocator; see kinit above.)
+// Drop a reference to the page of physical memory pointed
+// at by v, which normally should have been returned by a
+// call to kalloc().  (The exception is when initializing
+// the allocator; see kinit above.)  The page is freed when
+// its last reference goes away.
 void
 kfree(char *v)
 {
   struct run *r;
+  uchar *ref;
 
   if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
     panic("kfree");
 
+  ref = &kmem.ref[V2P(v)/PGSIZE];
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  if(*ref == 0)
+    panic("kfree: page not allocated");
+  if(--*ref > 0){
+    if(kmem.use_lock)
+      release(&kmem.lock);
+    return;
+  }
+  if(kmem.use_lock)
+    release(&kmem.lock);
+
+#ifdef KALLOC_JUNK
   // Fill with junk to catch dangling refs.
   memset(v, 1, PGSIZE);
+#endif // KALLOC_JUNK
 
   if(kmem.use_lock)
     acquire(&kmem.lock);
   r = (struct run*)v;
   r->next = kmem.freelist;
   kmem.freelist = r;
+  kmem.nfree++;
   if(kmem.use_lock)
     release(&kmem.lock);
 }
 
+// Drop a reference to each of the n pages in v[], as kfree()
+// does, but taking kmem.lock once for all of them.  Used to
+// tear down address spaces.  Overwrites v[].
+void
+kfreen(char **v, int n)
+{
+  struct run *r;
+  uchar *ref;
+  int i;
+
+  for(i = 0; i < n; i++)
+    if((uint)v[i] % PGSIZE || v[i] < end || V2P(v[i]) >= PHYSTOP)
+      panic("kfreen");
+
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  for(i = 0; i < n; i++){
+    ref = &kmem.ref[V2P(v[i])/PGSIZE];
+    if(*ref == 0)
+      panic("kfreen: page not allocated");
+    if(--*ref > 0)
+      v[i] = 0;  // still in use
+  }
+  if(kmem.use_lock)
+    release(&kmem.lock);
+
+#ifdef KALLOC_JUNK
+  for(i = 0; i < n; i++)
+    if(v[i])
+      memset(v[i], 1, PGSIZE);
+#endif // KALLOC_JUNK
+
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  for(i = 0; i < n; i++){
+    if(v[i] == 0)
+      continue;
+    r = (struct run*)v[i];
+    r->next = kmem.freelist;
+    kmem.freelist = r;
+    kmem.nfree++;
+  }
+  if(kmem.use_lock)
+    release(&kmem.lock);
+}
+
+// Take a page off the zero list.  Caller must hold kmem.lock
+// if kmem.use_lock is set.
+static struct run*
+zeropop(void)
+{
+  struct run *r;
+
+  if((r = kmem.zerolist) != 0){
+    kmem.zerolist = r->next;
+    kmem.nzero--;
+    r->next = 0;  // all zero again
+  }
+  return r;
+}
+
 // Allocate one 4096-byte page of physical memory.
 // Returns a pointer that the kernel can use.
 // Returns 0 if the memory cannot be allocated.
+// Leaves the zeroed pages for kzalloc() while it can.
 char*
 kalloc(void)
 {
@@ -89,8 +178,194 @@ kalloc(void)
   r = kmem.freelist;
   if(r)
     kmem.freelist = r->next;
+  else
+    r = zeropop();
+  if(r){
+    kmem.ref[V2P(r)/PGSIZE] = 1;
+    kmem.nfree--;
+  }
   if(kmem.use_lock)
     release(&kmem.lock);
   return (char*)r;
 }
 
+// Allocate one 4096-byte page of physical memory filled with
+// zeros.  Returns 0 if the memory cannot be allocated.
+// Usually the page comes from the pool that idle CPUs keep
+// topped up (see kzfill()), so no time is spent zeroing it.
+char*
+kzalloc(void)
+{
+  struct run *r;
+
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  if((r = zeropop()) != 0){
+    kmem.ref[V2P(r)/PGSIZE] = 1;
+    kmem.nfree--;
+  }
+  if(kmem.use_lock)
+    release(&kmem.lock);
+  if(r)
+    return (char*)r;
+  if((r = (struct run*)kalloc()) != 0)
+    memset(r, 0, PGSIZE);
+  return (char*)r;
+}
+
+// Zero one free page and move it to the zero list, unless
+// there are already NZPAGE zeroed pages.  Called by idle
+// CPUs from scheduler().  Returns 1 if it did any work.
+int
+kzfill(void)
+{
+  struct run *r;
+
+  if(!kmem.use_lock)
+    return 0;
+  acquire(&kmem.lock);
+  if(kmem.nzero >= NZPAGE || (r = kmem.freelist) == 0){
+    release(&kmem.lock);
+    return 0;
+  }
+  kmem.freelist = r->next;
+  release(&kmem.lock);
+
+  memset(r, 0, PGSIZE);
+
+  acquire(&kmem.lock);
+  r->next = kmem.zerolist;
+  kmem.zerolist = r;
+  kmem.nzero++;
+  release(&kmem.lock);
+  return 1;
+}
+
+// Add a reference to the page at v, which must already be
+// allocated.  Used for pages mapped into several address spaces.
+void
+kref(char *v)
+{
+  uchar *ref;
+
+  if((uint)v % PGSIZE || v < end || V2P(v) >= PHYSTOP)
+    panic("kref");
+
+  ref = &kmem.ref[V2P(v)/PGSIZE];
+  if(kmem.use_lock)
+    acquire(&kmem.lock);
+  if(*ref == 0 || *ref == 255)
+    panic("kref: bad count");
+  (*ref)++;
+  if(kmem.use_lock)
+    release(&kmem.lock);
+}
+
+// Return the number of references to the page at v.
+// The answer may be stale by the time the caller looks at it.
+int
+krefcount(char *v)
+{
+  return kmem.ref[V2P(v)/PGSIZE];
+}
+
+
+//PAGEBREAK!
+// Large pages.
+//
+// Large-page user mappings (mmap with MAP_HUGETLB) need
+// LPGSIZE bytes of physically contiguous, aligned memory,
+// which the free list cannot provide.  main() sets aside
+// NLPAGE of them at the top of physical memory instead.
+struct {
+  struct spinlock lock;
+  char *base;
+  uchar ref[NLPAGE];
+} lpool;
+
+void
+lpinit(void *vstart)
+{
+  initlock(&lpool.lock, "lpool");
+  lpool.base = (char*)vstart;
+}
+
+static uchar*
+lpref_of(char *v)
+{
+  if(v < lpool.base || v >= lpool.base + NLPAGE*LPGSIZE ||
+     (v - lpool.base) % LPGSIZE)
+    panic("lpool");
+  return &lpool.ref[(v - lpool.base) / LPGSIZE];
+}
+
+// Allocate one zeroed large page.
+// Returns 0 if the pool is empty.
+char*
+lpalloc(void)
+{
+  int i;
+  char *v;
+
+  acquire(&lpool.lock);
+  for(i = 0; i < NLPAGE; i++){
+    if(lpool.ref[i] == 0){
+      lpool.ref[i] = 1;
+      release(&lpool.lock);
+      v = lpool.base + i*LPGSIZE;
+      memset(v, 0, LPGSIZE);
+      return v;
+    }
+  }
+  release(&lpool.lock);
+  return 0;
+}
+
+// Add a reference to the large page at v.
+void
+lpref(char *v)
+{
+  uchar *ref;
+
+  acquire(&lpool.lock);
+  ref = lpref_of(v);
+  if(*ref == 0 || *ref == 255)
+    panic("lpref: bad count");
+  (*ref)++;
+  release(&lpool.lock);
+}
+
+// Drop a reference to the large page at v.
+void
+lpfree(char *v)
+{
+  uchar *ref;
+
+  acquire(&lpool.lock);
+  ref = lpref_of(v);
+  if(*ref == 0)
+    panic("lpfree: page not allocated");
+  (*ref)--;
+  release(&lpool.lock);
+}
+
+// Fill in the allocator's part of m.
+void
+kmemstat(struct meminfo *m)
+{
+  int i;
+
+  acquire(&kmem.lock);
+  m->total = kmem.npage;
+  m->free = kmem.nfree;
+  m->zero = kmem.nzero;
+  release(&kmem.lock);
+
+  acquire(&lpool.lock);
+  m->lptotal = NLPAGE;
+  m->lpfree = 0;
+  for(i = 0; i < NLPAGE; i++)
+    if(lpool.ref[i] == 0)
+      m->lpfree++;
+  release(&lpool.lock);
+}
@@ -1,6 +1,8 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
+#include "proc.h"
 #include "spinlock.h"
 #include "sleeplock.h"
 #include "fs.h"
@@ -15,10 +17,41 @@
 // write an uncommitted system call's updates to disk.
 //
 // A system call should call begin_op()/end_op() to mark
-// its start and end. Usually begin_op() just increments
-// the count of in-progress FS system calls and returns.
-// But if it thinks the log is close to running out, it
-// sleeps until the last outstanding end_op() commits.
+// its start and end, telling begin_op() how many blocks it may
+// write (see OP_IPUT and friends in param.h).  Usually
+// begin_op() just reserves that much room in the transaction
+// and returns.  But if the transaction lacks room, it sleeps
+// until the transaction has been handed off to commit.
+//
+// There are two transactions: the open one, which system
+// calls add their updates to, and the one being committed.
+// The committer thread commits the open transaction once it
+// is FLUSHTICKS old, or sooner if it is filling up, memory is
+// short or sync() or fsync() wants it.  It waits for the
+// outstanding system calls to end, holding off new ones, and
+// copies the transaction's blocks aside.  Then it opens a new
+// transaction and lets system calls go on while it writes the
+// copies to the log and their home locations.  So system calls
+// never wait for the disk unless they fill the open transaction
+// before the last one is done, but a crash loses up to
+// FLUSHTICKS of updates that were not synced.
+//
+// A block stays pinned in the buffer cache (B_DIRTY) from
+// log_write() until the last transaction with it is installed.
+// The cached copy may be newer than the one being committed.
+//
+// In ordered mode, the default, regular files' data blocks
+// are not logged: writei() hands them to log_data(), and
+// commit() writes them straight to their home locations,
+// before the transaction's metadata commits.  So file data is
+// written once, and a committed inode never points at blocks
+// that were not written.  Until the transaction commits, the
+// disk still says that a block it freed belongs to the file it
+// was freed from, so writing new data there in place could
+// leave the old file holding it after a crash.  balloc() hands
+// such a block out again only when no other is free, and then
+// log_data() logs it like metadata (see log_free()).  Build
+// with JOURNAL=data to log file data like everything else.
 //
 // The log is a physical re-do log containing disk blocks.
 // The on-disk log format:
@@ -28,6 +61,17 @@
 //   block C
 //   ...
 // Log appends are synchronous.
+//
+// mkfs decides the size of the log (mkfs -l); the transaction
+// holds one block fewer, and at most LOGSIZE.
+
+#ifdef PDX_XV6
+#define FLUSHTICKS  TPS    // commit at least once a second
+#else
+#define FLUSHTICKS  100
+#endif
+
+#define NLOGHASH    64   // hash chains for finding logged blocks
 
 // Contents of the header block, used for both the on-disk header block
 // and to keep track in memory of logged block# before commit.
@@ -36,23 +80,55 @@ struct logheader {
   int block[LOGSIZE];
 };
 
+// File data blocks of a transaction, in ordered mode.
+struct logdata {
+  int n;
+  int block[LOGDATA];
+};
+
 struct log {
   struct spinlock lock;
   int start;
   int size;
+  int cap;         // most blocks a transaction can log
   int outstanding; // how many FS sys calls are executing.
-  int committing;  // in commit(), please wait.
+  int reserved;    // log blocks they may still write
+  int dreserved;   // and file data blocks
+  int committing;  // committer is writing ch
+  int freezing;    // committer is waiting for outstanding ops to end
+  int flushwant;   // commit the open transaction soon
+  uint ncommit;    // commits done
+  uint begun;      // ticks when the open transaction began
   int dev;
-  struct logheader lh;
+  struct logheader lh;  // the open transaction
+  struct logdata ld;    // and its file data blocks
+  struct logheader ch;  // the one being committed; only the committer
+  struct logdata cd;    // touches these, and only while committing is set
+  // Hash of the open transaction's blocks: entry e < LOGSIZE
+  // is lh.block[e], and LOGSIZE+j is ld.block[j].
+  short hash[NLOGHASH];
+  short hnext[LOGSIZE+LOGDATA];
+  uchar freed[(FSSIZE+7)/8];  // blocks the open transaction freed
 };
 struct log log;
 
+// Bufs holding copies of the blocks of the transaction being
+// committed, as they were when it closed.  Metadata blocks come
+// first, then file data blocks.
+static struct buf cbuf[LOGSIZE+LOGDATA];
+
 static void recover_from_log(void);
 static void commit();
+static void committer(void);
+static int intx(uint);
+static void txclear(void);
 
 void
 initlog(int dev)
 {
+  char *mem;
+  int i;
+
   if (sizeof(struct logheader) >= BSIZE)
     panic("initlog: too big logheader");
 
@@ -61,23 +137,39 @@ initlog(int dev)
   readsb(dev, &sb);
   log.start = sb.logstart;
   log.size = sb.nlog;
+  log.cap = log.size - 1 < LOGSIZE ? log.size - 1 : LOGSIZE;
+  if (log.cap < MAXOPLOG)
+    panic("initlog: log too small; remake fs with larger mkfs -l");
   log.dev = dev;
+  mem = 0;
+  for (i = 0; i < log.cap+LOGDATA; i++) {
+    if (i % (PGSIZE/BSIZE) == 0 && (mem = kalloc()) == 0)
+      panic("initlog: no memory");
+    initsleeplock(&cbuf[i].lock, "log copy");
+    cbuf[i].data = (uchar*)mem + (i % (PGSIZE/BSIZE))*BSIZE;
+  }
   recover_from_log();
+  txclear();
+  kthread("logcommit", committer);
 }
 
 // Copy committed blocks from log to their home location
 static void
 install_trans(void)
 {
+  struct buf *dbuf[LOGSIZE];
   int tail;
 
   for (tail = 0; tail < log.lh.n; tail++) {
     struct buf *lbuf = bread(log.dev, log.start+tail+1); // read log block
-    struct buf *dbuf = bread(log.dev, log.lh.block[tail]); // read dst
-    memmove(dbuf->data, lbuf->data, BSIZE);  // copy block to dst
-    bwrite(dbuf);  // write dst to disk
+    dbuf[tail] = bread(log.dev, log.lh.block[tail]); // read dst
+    memmove(dbuf[tail]->data, lbuf->data, BSIZE);  // copy block to dst
+    bwrite_async(dbuf[tail], 0);  // start writing dst to disk
     brelse(lbuf);
-    brelse(dbuf);
+  }
+  for (tail = 0; tail < log.lh.n; tail++) {
+    bwait(dbuf[tail]);
+    brelse(dbuf[tail]);
   }
 }
 
@@ -95,18 +187,18 @@ read_head(void)
   brelse(buf);
 }
 
-// Write in-memory log header to disk.
+// Write in-memory log header h to disk.
 // This is the true point at which the
 // current transaction commits.
 static void
-write_head(void)
+write_head(struct logheader *h)
 {
   struct buf *buf = bread(log.dev, log.start);
   struct logheader *hb = (struct logheader *) (buf->data);
   int i;
-  hb->n = log.lh.n;
-  for (i = 0; i < log.lh.n; i++) {
-    hb->block[i] = log.lh.block[i];
+  hb->n = h->n;
+  for (i = 0; i < h->n; i++) {
+    hb->block[i] = h->block[i];
   }
   bwrite(buf);
   brelse(buf);
@@ -118,22 +210,65 @@ recover_from_log(void)
   read_head();
   install_trans(); // if committed, copy from log to disk
   log.lh.n = 0;
-  write_head(); // clear the log
+  write_head(&log.lh); // clear the log
+}
+
+// Does the open transaction have no blocks?
+// Caller must hold log.lock, or not mind a stale answer.
+static int
+txempty(void)
+{
+  return log.lh.n == 0 && log.ld.n == 0;
+}
+
+// A block is being added to the open transaction.
+// Caller must hold log.lock.
+static void
+txstart(void)
+{
+  if (txempty()) {
+    log.begun = ticks;
+    wakeup(&log.lh);  // for the committer
+  }
+}
+
+// called at the start of each FS system call that may write
+// n blocks to the log.
+void
+begin_op(int n)
+{
+  begin_opdata(n, 0);
 }
 
-// called at the start of each FS system call.
+// called at the start of each FS system call that may write
+// n blocks to the log and ndata blocks of regular files.
 void
-begin_op(void)
+begin_opdata(int n, int ndata)
 {
+  struct proc *p = myproc();
+
+#ifdef JOURNAL_DATA
+  n += ndata;  // file data is logged too
+  ndata = 0;
+#endif
+  if(n > log.cap || ndata > LOGDATA)
+    panic("begin_op: too big");
+
   acquire(&log.lock);
   while(1){
-    if(log.committing){
+    if(log.freezing){
       sleep(&log, &log.lock);
-    } else if(log.lh.n + (log.outstanding+1)*MAXOPBLOCKS > LOGSIZE){
+    } else if(log.lh.n + log.reserved + n > log.cap ||
+              log.ld.n + log.dreserved + ndata > LOGDATA){
       // this op might exhaust log space; wait for commit.
+      log.flushwant = 1;
       sleep(&log, &log.lock);
     } else {
       log.outstanding += 1;
+      log.reserved += n;
+      log.dreserved += ndata;
+      p->oplog = n;
+      p->opdata = ndata;
       release(&log.lock);
       break;
     }
@@ -141,63 +276,266 @@ begin_op(void)
 }
 
 // called at the end of each FS system call.
-// commits if this was the last outstanding operation.
 void
 end_op(void)
 {
-  int do_commit = 0;
+  struct proc *p = myproc();
 
   acquire(&log.lock);
   log.outstanding -= 1;
-  if(log.committing)
-    panic("log.committing");
-  if(log.outstanding == 0){
-    do_commit = 1;
-    log.committing = 1;
-  } else {
-    // begin_op() may be waiting for log space,
-    // and decrementing log.outstanding has decreased
-    // the amount of reserved space.
-    wakeup(&log);
+  log.reserved -= p->oplog;
+  log.dreserved -= p->opdata;
+  // the committer may be waiting for outstanding ops to end,
+  // and begin_op() may be waiting for log space, and
+  // releasing this op's reservation has made room.
+  wakeup(&log);
+  release(&log.lock);
+}
+
+// Commit the open transaction and wait for it to reach the
+// disk, so that all FS system calls that have finished are
+// durable.
+void
+logsync(void)
+{
+  uint want;
+
+  acquire(&log.lock);
+  // The caller's updates are in the transaction being
+  // committed, if any, or the open one.
+  want = log.ncommit + (log.committing ? 1 : 0) + (!txempty() ? 1 : 0);
+  if(!txempty())
+    log.flushwant = 1;
+  while(log.ncommit < want)
+    sleep(&log, &log.lock);
+  release(&log.lock);
+}
+
+// Ask the committer to commit soon, so that the transaction's
+// blocks can leave the buffer cache.  Called when memory is
+// short, maybe with spin locks held, so it takes no locks;
+// the committer looks at flushwant every tick.
+void
+logkick(void)
+{
+  if(!txempty())
+    log.flushwant = 1;
+}
+
+// Sort the n block numbers in block[], so that blocks go to
+// their home locations in order.
+static void
+sortblocks(int *block, int n)
+{
+  int i, j, b;
+
+  for (i = 1; i < n; i++) {
+    b = block[i];
+    for (j = i; j > 0 && block[j-1] > b; j--)
+      block[j] = block[j-1];
+    block[j] = b;
   }
+}
+
+// Close the open transaction: copy its blocks aside and make
+// it the one being committed.  Caller must hold log.lock,
+// which is dropped while copying, and there must be no
+// outstanding FS system calls; log.freezing keeps new ones out.
+static void
+freeze(void)
+{
+  struct buf *b;
+  int i;
+
+  log.freezing = 1;
+  log.committing = 1;
+  log.flushwant = 0;
+  log.ch = log.lh;
+  log.cd = log.ld;
+  txclear();
+  sortblocks(log.ch.block, log.ch.n);
+  sortblocks(log.cd.block, log.cd.n);
   release(&log.lock);
+  for (i = 0; i < log.ch.n; i++) {
+    b = bread(log.dev, log.ch.block[i]);
+    memmove(cbuf[i].data, b->data, BSIZE);
+    brelse(b);
+  }
+  for (i = 0; i < log.cd.n; i++) {
+    b = bread(log.dev, log.cd.block[i]);
+    memmove(cbuf[log.ch.n+i].data, b->data, BSIZE);
+    brelse(b);
+  }
+  acquire(&log.lock);
+  log.freezing = 0;
+  wakeup(&log);
+}
 
-  if(do_commit){
-    // call commit w/o holding locks, since not allowed
-    // to sleep with locks.
-    commit();
-    acquire(&log.lock);
-    log.committing = 0;
-    wakeup(&log);
-    release(&log.lock);
+// The committer thread.  Commits the open transaction once
+// it is FLUSHTICKS old or a commit is wanted.
+static void
+committer(void)
+{
+  acquire(&log.lock);
+  for(;;){
+    if(txempty()){
+      sleep(&log.lh, &log.lock);
+    } else if(!log.flushwant && ticks - log.begun < FLUSHTICKS){
+      sleep(&ticks, &log.lock);
+    } else if(log.outstanding > 0){
+      log.freezing = 1;
+      sleep(&log, &log.lock);
+    } else {
+      freeze();
+      // call commit w/o holding locks, since not allowed
+      // to sleep with locks.
+      release(&log.lock);
+      commit();
+      acquire(&log.lock);
+      log.committing = 0;
+      log.ncommit++;
+      wakeup(&log);
+    }
   }
 }
 
-// Copy modified blocks from cache to log.
+// Write the copies of the committed metadata blocks to the
+// log, and of the file data blocks to their home locations.
 static void
 write_log(void)
+{
+  int tail, n;
+
+  n = log.ch.n + log.cd.n;
+  for (tail = 0; tail < n; tail++) {
+    acquiresleep(&cbuf[tail].lock);
+    cbuf[tail].dev = log.dev;
+    if (tail < log.ch.n)
+      cbuf[tail].blockno = log.start+tail+1; // log block
+    else
+      cbuf[tail].blockno = log.cd.block[tail-log.ch.n];
+    bwrite_async(&cbuf[tail], 0);  // start writing the log
+  }
+  for (tail = 0; tail < n; tail++) {
+    bwait(&cbuf[tail]);
+    releasesleep(&cbuf[tail].lock);
+  }
+}
+
+// The block of hash entry e.  Caller must hold log.lock.
+static uint
+entblock(int e)
+{
+  return e < LOGSIZE ? log.lh.block[e] : log.ld.block[e-LOGSIZE];
+}
+
+// Return the hash entry for block in the open transaction,
+// or -1 if it has none.  Caller must hold log.lock.
+static int
+txfind(uint block)
+{
+  int e;
+
+  for (e = log.hash[block % NLOGHASH]; e >= 0; e = log.hnext[e])
+    if (entblock(e) == block)
+      return e;
+  return -1;
+}
+
+// Add entry e to the hash.  Caller must hold log.lock.
+static void
+txhash(int e)
+{
+  uint h;
+
+  h = entblock(e) % NLOGHASH;
+  log.hnext[e] = log.hash[h];
+  log.hash[h] = e;
+}
+
+// Remove entry e from the hash.  Caller must hold log.lock.
+static void
+txunhash(int e)
+{
+  short *p;
+
+  for (p = &log.hash[entblock(e) % NLOGHASH]; *p != e; p = &log.hnext[*p])
+    ;
+  *p = log.hnext[e];
+}
+
+// Empty the open transaction.  Caller must hold log.lock.
+static void
+txclear(void)
+{
+  int i;
+
+  log.lh.n = 0;
+  log.ld.n = 0;
+  for (i = 0; i < NLOGHASH; i++)
+    log.hash[i] = -1;
+  memset(log.freed, 0, sizeof(log.freed));
+}
+
+// Is block in the open transaction?  Caller must hold log.lock.
+static int
+intx(uint block)
+{
+  return txfind(block) >= 0;
+}
+
+// Unpin the cached copy of block unless the open transaction
+// has written it since.
+static void
+unpin(uint block)
+{
+  struct buf *b;
+
+  // Holding b's lock keeps log_write() from adding it to
+  // the open transaction meanwhile.
+  b = bread(log.dev, block);
+  acquire(&log.lock);
+  if (!intx(block))
+    b->flags &= ~B_DIRTY;
+  release(&log.lock);
+  brelse(b);
+}
+
+// Write the copies of the committed metadata blocks to their
+// home locations, and unpin the committed blocks.
+static void
+install_copies(void)
 {
   int tail;
 
-  for (tail = 0; tail < log.lh.n; tail++) {
-    struct buf *to = bread(log.dev, log.start+tail+1); // log block
-    struct buf *from = bread(log.dev, log.lh.block[tail]); // cache block
-    memmove(to->data, from->data, BSIZE);
-    bwrite(to);  // write the log
-    brelse(from);
-    brelse(to);
+  for (tail = 0; tail < log.ch.n; tail++) {
+    acquiresleep(&cbuf[tail].lock);
+    cbuf[tail].blockno = log.ch.block[tail];
+    bwrite_async(&cbuf[tail], 0);  // start writing dst to disk
   }
+  for (tail = 0; tail < log.ch.n; tail++) {
+    bwait(&cbuf[tail]);
+    releasesleep(&cbuf[tail].lock);
+  }
+
+  for (tail = 0; tail < log.ch.n; tail++)
+    unpin(log.ch.block[tail]);
+  for (tail = 0; tail < log.cd.n; tail++)
+    unpin(log.cd.block[tail]);
 }
 
 static void
 commit()
 {
-  if (log.lh.n > 0) {
-    write_log();     // Write modified blocks from cache to log
-    write_head();    // Write header to disk -- the real commit
-    install_trans(); // Now install writes to home locations
-    log.lh.n = 0;
-    write_head();    // Erase the transaction from the log
+  struct logheader empty;
+
+  write_log();            // Write copies to log, file data home
+  if (log.ch.n > 0)
+    write_head(&log.ch);  // Write header to disk -- the real commit
+  install_copies();       // Now install writes to home locations
+  if (log.ch.n > 0) {
+    empty.n = 0;
+    write_head(&empty);   // Erase the transaction from the log
   }
 }
 
@@ -213,22 +551,114 @@ commit()
 void
 log_write(struct buf *b)
 {
-  int i;
+  int e, last;
 
-  if (log.lh.n >= LOGSIZE || log.lh.n >= log.size - 1)
+  if (log.lh.n >= log.cap)
     panic("too big a transaction");
   if (log.outstanding < 1)
     panic("log_write outside of trans");
 
   acquire(&log.lock);
-  for (i = 0; i < log.lh.n; i++) {
-    if (log.lh.block[i] == b->blockno)   // log absorbtion
-      break;
+  if ((e = txfind(b->blockno)) >= LOGSIZE) {
+    // file data until now: move it to the metadata.
+    txunhash(e);
+    last = LOGSIZE + --log.ld.n;
+    if (e != last) {
+      txunhash(last);
+      log.ld.block[e-LOGSIZE] = log.ld.block[log.ld.n];
+      txhash(e);
+    }
+    e = -1;
+  }
+  if (e < 0) {   // not log absorption
+    txstart();
+    log.lh.block[log.lh.n] = b->blockno;
+    txhash(log.lh.n++);
+  }
+  b->flags |= B_DIRTY; // prevent eviction
+  release(&log.lock);
+}
+
+// Caller has modified b->data, a data block of a regular file,
+// and is done with the buffer.  Like log_write(), but in ordered
+// mode commit() writes the block to its home location instead
+// of the log.  If the transaction has logged the block as
+// metadata, or freed it, it is logged.
+void
+log_data(struct buf *b)
+{
+#ifdef JOURNAL_DATA
+  log_write(b);
+#else
+  if (log.outstanding < 1)
+    panic("log_data outside of trans");
+  if (log_freed(b->blockno)) {
+    log_write(b);
+    return;
+  }
+
+  acquire(&log.lock);
+  if (!intx(b->blockno)) {
+    if (log.ld.n >= LOGDATA)
+      panic("too much data in a transaction");
+    txstart();
+    log.ld.block[log.ld.n] = b->blockno;
+    txhash(LOGSIZE + log.ld.n++);
   }
-  log.lh.block[i] = b->blockno;
-  if (i == log.lh.n)
-    log.lh.n++;
   b->flags |= B_DIRTY; // prevent eviction
   release(&log.lock);
+#endif // JOURNAL_DATA
 }
 
+// The open transaction is freeing block b.  In ordered mode,
+// remember it, so that balloc() leaves it alone until the
+// transaction commits if it can, and log_data() logs it if
+// balloc() can't.
+void
+log_free(uint b)
+{
+#ifndef JOURNAL_DATA
+  if (b >= FSSIZE)
+    panic("log_free");
+  acquire(&log.lock);
+  log.freed[b/8] |= 1 << (b%8);
+  release(&log.lock);
+#endif // JOURNAL_DATA
+}
+
+// Did the open transaction free block b?
+int
+log_freed(uint b)
+{
+#ifdef JOURNAL_DATA
+  return 0;
+#else
+  int r;
+
+  acquire(&log.lock);
+  r = b < FSSIZE && (log.freed[b/8] & (1 << (b%8)));
+  release(&log.lock);
+  return r;
+#endif // JOURNAL_DATA
+}
+
+// The calling op is about to reuse a block that the open
+// transaction freed, which log_data() will log.  Add room for
+// it to the op's reservation.  Returns -1 if the transaction
+// has none.
+int
+log_reuse(void)
+{
+  struct proc *p = myproc();
+  int r;
+
+  r = -1;
+  acquire(&log.lock);
+  if (log.lh.n + log.reserved < log.cap) {
+    log.reserved++;
+    p->oplog++;
+    r = 0;
+  }
+  release(&log.lock);
+  return r;
+}
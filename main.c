@@ -28,12 +28,17 @@ main(void)
   uartinit();      // serial port
   pinit();         // process table
   tvinit();        // trap vectors
-  binit();         // buffer cache
   fileinit();      // file table
+  pcinit();        // shared file pages
+  shminit();       // shared memory segments
   ideinit();       // disk 
+  swapinit();      // swap area
   startothers();   // start other processors
-  kinit2(P2V(4*1024*1024), P2V(PHYSTOP)); // must come after startothers()
+  kinit2(P2V(4*1024*1024), P2V(PHYSTOP-NLPAGE*LPGSIZE)); // must come after startothers()
+  lpinit(P2V(PHYSTOP-NLPAGE*LPGSIZE));  // large pages
+  binit();         // buffer cache, sized from memory
   userinit();      // first user process
+  kthread("reaper", reaper);  // frees exited address spaces
   mpmain();        // finish this processor's setup
 }
 
@@ -13,7 +13,9 @@
 #include "fs.h"
 #include "buf.h"
 
-extern uchar _binary_fs_img_start[], _binary_fs_img_size[];
+extern uchar _binary_memfs_img_start[], _binary_memfs_img_size[];
+
+int ideirq = IRQ_IDE;
 
 static int disksize;
 static uchar *memdisk;
@@ -21,8 +23,15 @@ static uchar *memdisk;
 void
 ideinit(void)
 {
-  memdisk = _binary_fs_img_start;
-  disksize = (uint)_binary_fs_img_size/BSIZE;
+  memdisk = _binary_memfs_img_start;
+  disksize = (uint)_binary_memfs_img_size/BSIZE;
+}
+
+// Number of blocks on disk dev.
+uint
+idesize(uint dev)
+{
+  return dev == 1 ? disksize : 0;
 }
 
 // Interrupt handler.
@@ -35,10 +44,13 @@ ideintr(void)
 // Sync buf with disk.
 // If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
 // Else if B_VALID is not set, read buf from disk, set B_VALID.
+// The copy is done at once, so b->done(b) is called, if set,
+// before returning.
 void
-iderw(struct buf *b)
+idesubmit(struct buf *b)
 {
   uchar *p;
+  void (*done)(struct buf*);
 
   if(!holdingsleep(&b->lock))
     panic("iderw: buf not locked");
@@ -57,4 +69,23 @@ iderw(struct buf *b)
   } else
     memmove(b->data, p, BSIZE);
   b->flags |= B_VALID;
+  done = b->done;
+  b->done = 0;
+  if(done)
+    done(b);
+}
+
+// Requests finish in idesubmit(); there is nothing to wait for.
+void
+idewaitbuf(struct buf *b)
+{
+  if((b->flags & (B_VALID|B_DIRTY)) != B_VALID)
+    panic("idewaitbuf");
+}
+
+// Sync buf with disk.
+void
+iderw(struct buf *b)
+{
+  idesubmit(b);
 }
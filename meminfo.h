@@ -0,0 +1,21 @@
+// System memory statistics, filled in by meminfo().
+// Sizes are in pages; counts are since boot.
+struct meminfo {
+  uint total;       // pages kalloc() manages
+  uint free;        // free pages
+  uint zero;        // free pages already zeroed
+  uint lptotal;     // large pages set aside for MAP_HUGETLB
+  uint lpfree;      // free large pages
+  uint kstack;      // pages of kernel stacks
+  uint pgtab;       // pages of user page tables and directories
+  uint pcache;      // pages in the file page cache
+  uint bcache;      // pages in the disk block cache
+  uint shm;         // pages in shared memory segments
+  uint minflt;      // page faults served from memory
+  uint majflt;      // page faults that read from disk
+  uint cowflt;      // copy-on-write breaks
+  uint swaptotal;   // pages of swap space
+  uint swapused;    // pages of swap in use
+  uint swapout;     // pages written to swap
+  uint swapin;      // pages read back from swap
+};
@@ -18,11 +18,11 @@
 #define NINODES 200
 
 // Disk layout:
-// [ boot block | sb block | log | inode blocks | free bit map | data blocks ]
+// [ boot block | sb block | log | inode blocks | free bit map | data blocks | swap ]
 
 int nbitmap = FSSIZE/(BSIZE*8) + 1;
 int ninodeblocks = NINODES / IPB + 1;
-int nlog = LOGSIZE;
+int nlog = NLOG;      // log blocks, with header; -l to change
 int nmeta;    // Number of meta blocks (boot, sb, nlog, inode, bitmap)
 int nblocks;  // Number of data blocks
 
@@ -67,7 +67,7 @@ xint(uint x)
 int
 main(int argc, char *argv[])
 {
-  int i, cc, fd;
+  int i, cc, fd, swap;
   uint rootino, inum, off;
   struct dirent de;
   char buf[BSIZE];
@@ -76,8 +76,27 @@ main(int argc, char *argv[])
 
   static_assert(sizeof(int) == 4, "Integers must be 4 bytes!");
 
-  if(argc < 2){
-    fprintf(stderr, "Usage: mkfs fs.img files...\n");
+  // -S leaves out the swap area, for images built into the kernel.
+  // -l n makes the log n blocks long.
+  swap = 1;
+  for(; argc > 1 && argv[1][0] == '-'; argc--, argv++){
+    if(strcmp(argv[1], "-S") == 0)
+      swap = 0;
+    else if(strcmp(argv[1], "-l") == 0 && argc > 2){
+      nlog = atoi(argv[2]);
+      argc--;
+      argv++;
+    } else
+      break;
+  }
+
+  if(argc < 2 || argv[1][0] == '-'){
+    fprintf(stderr, "Usage: mkfs [-S] [-l nlog] fs.img files...\n");
+    exit(1);
+  }
+  if(nlog < MAXOPLOG+1 || nlog > LOGSIZE+1){
+    fprintf(stderr, "mkfs: log must have %d to %d blocks\n",
+            MAXOPLOG+1, LOGSIZE+1);
     exit(1);
   }
 
@@ -109,6 +128,10 @@ main(int argc, char *argv[])
 
   for(i = 0; i < FSSIZE; i++)
     wsect(i, zeroes);
+  // The swap area follows the file system; its contents don't
+  // matter, so just extend the image to cover it.
+  if(swap)
+    wsect(FSSIZE + SWAPSIZE - 1, zeroes);
 
   memset(buf, 0, sizeof(buf));
   memmove(buf, &sb, sizeof(sb));
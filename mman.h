@@ -0,0 +1,10 @@
+#define PROT_READ      0x1
+#define PROT_WRITE     0x2
+
+#define MAP_SHARED     0x01
+#define MAP_PRIVATE    0x02
+#define MAP_FIXED      0x10
+#define MAP_ANONYMOUS  0x20
+#define MAP_HUGETLB    0x40    // use 4MB pages (anonymous only)
+
+#define MAP_FAILED     ((void*)-1)
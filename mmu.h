@@ -123,6 +123,7 @@ struct segdesc {
 #define NPDENTRIES      1024    // # directory entries per page directory
 #define NPTENTRIES      1024    // # PTEs per page table
 #define PGSIZE          4096    // bytes mapped by a page
+#define LPGSIZE         (PGSIZE*NPTENTRIES) // bytes mapped by a large (PTE_PS) page
 
 #define PGSHIFT         12      // log2(PGSIZE)
 #define PTXSHIFT        12      // offset of PTX in a linear address
@@ -141,6 +142,9 @@ struct segdesc {
 #define PTE_D           0x040   // Dirty
 #define PTE_PS          0x080   // Page Size
 #define PTE_MBZ         0x180   // Bits must be zero
+#define PTE_COW         0x200   // Copy on write (available to software)
+#define PTE_SHR         0x400   // Shared with other processes (available to software)
+#define PTE_SWAP        0x800   // Paged out; address holds swap slot (available to software)
 
 // Address in page table or page directory entry
 #define PTE_ADDR(pte)   ((uint)(pte) & ~0xFFF)
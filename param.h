@@ -2,16 +2,51 @@
 #define KSTACKSIZE 4096  // size of per-process kernel stack
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
+#define NVMA         16  // mapped regions per process
+#define NSHM         16  // shared memory segments
+#define SHMPAGES    256  // max pages per shared memory segment
+#define NLPAGE        4  // 4MB pages set aside for large user mappings
+#define NZPAGE      256  // pre-zeroed free pages kept by idle CPUs
 #define NFILE       100  // open files per system
 #define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
 #define MAXARG       32  // max exec arguments
 #define MAXOPBLOCKS  10  // max # of blocks any FS op writes
-#define LOGSIZE      (MAXOPBLOCKS*3)  // max data blocks in on-disk log
-#define NBUF         (MAXOPBLOCKS*3)  // size of disk block cache
+#define LOGSIZE      126  // max data blocks in on-disk log; header fills a block
+#define NLOG         64  // default blocks in on-disk log, with header (mkfs -l)
+#define MAXOPDATA    64  // max # of file data blocks any FS op writes
+#define LOGDATA      (MAXOPDATA*4)  // max file data blocks in a transaction
+// max bytes of a file any FS op writes, allowing a block of slop
+// for non-aligned writes; with JOURNAL_DATA, the data blocks
+// take places in the log
+#ifdef JOURNAL_DATA
+#define MAXOPWRITE   (15 * 512)
+#else
+#define MAXOPWRITE   ((MAXOPDATA-1) * 512)
+#endif
+// Blocks each kind of FS op may write to the log, for
+// begin_op().  Each inode, directory, indirect and bitmap
+// block that an op may change counts once.  Any op may drop
+// the last reference to an unlinked inode and free it.
+#define NBITMAP      (FSSIZE/(512*8) + 1)  // bitmap blocks
+#define OP_IPUT      (1 + NBITMAP)  // inode, and bitmap to free its blocks
+#define OP_WRITE     (2 + NBITMAP)  // + indirect block; and file data
+#define OP_LINK      (4 + NBITMAP)  // inode, directory's block, indirect, inode
+#define OP_UNLINK    (3 + NBITMAP)  // directory's block and inode, inode
+#define OP_CREATE    (5 + NBITMAP)  // OP_LINK, + new directory's first block
+// The most any op reserves; the log must hold that many blocks
+// besides its header.  With JOURNAL_DATA, file data counts.
+#ifdef JOURNAL_DATA
+#define MAXOPLOG     (OP_WRITE + MAXOPWRITE/512 + 1)
+#else
+#define MAXOPLOG     OP_CREATE
+#endif
+#define NBUF         (MAXOPBLOCKS*3)  // minimum size of disk block cache
+#define MAXNBUF      4096  // maximum size of disk block cache
 #ifdef PDX_XV6
 #define FSSIZE       2000  // size of file system in blocks
 #else
 #define FSSIZE       1000  // size of file system in blocks
 #endif // PDX_XV6
+#define SWAPSIZE    16384  // blocks of swap space after the file system
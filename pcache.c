@@ -0,0 +1,333 @@
+// Cache of file pages.
+//
+// readi() of a regular file copies from whole pages of the
+// file held here, so file data does not crowd inode, bitmap
+// and directory blocks out of the buffer cache (bio.c), and
+// copies are page-sized.  Pages are indexed by file offset in
+// a per-file entry.  writei() still writes file data through
+// the buffer cache (see log_data()), and calls pcwrite() to
+// keep the cached pages up to date.
+//
+// The cache also serves mmap(): pagefault() asks pcpage() for
+// a page of a mapped file, so all processes that map the same
+// page of the same file get the same physical page, mapped
+// read-only.  Pages of writable segments are mapped
+// copy-on-write (PTE_COW) so that a process that writes one
+// gets its own copy.  write() changes cached pages in place,
+// mapped or not, so MAP_SHARED mappings are coherent with each
+// other and with write().  A private mapping sees write()s to
+// a page until it writes the page itself.
+//
+// Each entry counts the regions (struct vma) that map its file.
+// Entries that no region needs keep their pages and are
+// recycled, longest unused first, when another file needs one.
+// pcshrink() gives unmapped pages back when memory is short.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "meminfo.h"
+
+// Most pages a file can have, allowing for an offset
+// that is not page aligned.
+#define NPCPAGE  (MAXFILE*BSIZE/PGSIZE + 2)
+#define NSHRINK  16   // most pages pcshrink() frees at once
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+struct pcent {
+  uint dev;              // 0 if the entry has never been used
+  uint inum;
+  int ref;               // regions using this entry
+  uint gen;              // bumped when the pages are dropped
+  uint lastuse;          // ticks when last used
+  uint off[NPCPAGE];     // file offset of each page
+  char *mem[NPCPAGE];    // the page, or 0 if the slot is empty
+};
+
+// Every entry with ref > 0 belongs to an inode that some region
+// holds a reference to, so NINODE entries always leave room
+// for those.
+struct {
+  struct spinlock lock;
+  struct pcent ent[NINODE];
+} pcache;
+
+void
+pcinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+}
+
+// Find the entry for ip.  Caller must hold pcache.lock.
+static struct pcent*
+pclookup(struct inode *ip)
+{
+  struct pcent *e;
+
+  for(e = pcache.ent; e < &pcache.ent[NINODE]; e++)
+    if(e->dev == ip->dev && e->inum == ip->inum)
+      return e;
+  return 0;
+}
+
+// Release the cached pages of e.  Caller must hold pcache.lock.
+static void
+pcdrop(struct pcent *e)
+{
+  int i;
+
+  for(i = 0; i < NPCPAGE; i++){
+    if(e->mem[i]){
+      kfree(e->mem[i]);
+      e->mem[i] = 0;
+    }
+  }
+  e->gen++;
+}
+
+// Find the entry for ip, or give it the entry that has gone
+// unused longest among those no region needs.  Returns 0 if
+// there is none.  Caller must hold pcache.lock.
+static struct pcent*
+pcget(struct inode *ip)
+{
+  struct pcent *e, *old;
+
+  if((e = pclookup(ip)) == 0){
+    old = 0;
+    for(e = pcache.ent; e < &pcache.ent[NINODE]; e++)
+      if(e->ref == 0 && (old == 0 || e->lastuse < old->lastuse))
+        old = e;
+    if((e = old) == 0)
+      return 0;
+    pcdrop(e);
+    e->dev = ip->dev;
+    e->inum = ip->inum;
+  }
+  e->lastuse = ticks;
+  return e;
+}
+
+// Record a new region that maps ip.
+void
+pcref(struct inode *ip)
+{
+  struct pcent *e;
+
+  acquire(&pcache.lock);
+  if((e = pcget(ip)) == 0)
+    panic("pcref: no entries");
+  e->ref++;
+  release(&pcache.lock);
+}
+
+// A region that maps ip has gone away.
+void
+pcput(struct inode *ip)
+{
+  struct pcent *e;
+
+  acquire(&pcache.lock);
+  if((e = pclookup(ip)) == 0 || e->ref < 1)
+    panic("pcput");
+  e->ref--;
+  release(&pcache.lock);
+}
+
+// The contents of ip are going away: forget its cached pages.
+// Pages already mapped stay with the processes that map them.
+void
+pcinval(struct inode *ip)
+{
+  struct pcent *e;
+
+  acquire(&pcache.lock);
+  if((e = pclookup(ip)) != 0)
+    pcdrop(e);
+  release(&pcache.lock);
+}
+
+// The n bytes of ip at offset off have been changed to those
+// at data, copied from the writer's src.  Bring cached pages,
+// mapped ones too, up to date; a page that src lies in (a
+// mapping being synced) already is.  Caller must hold ip's
+// lock.
+void
+pcwrite(struct inode *ip, uint off, char *data, char *src, uint n)
+{
+  struct pcent *e;
+  uint lo, hi;
+  char *mem;
+  int i;
+
+  acquire(&pcache.lock);
+  if((e = pclookup(ip)) == 0){
+    release(&pcache.lock);
+    return;
+  }
+  for(i = 0; i < NPCPAGE; i++){
+    if((mem = e->mem[i]) == 0 ||
+       off + n <= e->off[i] || off >= e->off[i] + PGSIZE)
+      continue;
+    if(src >= mem && src < mem + PGSIZE)
+      continue;
+    lo = off > e->off[i] ? off : e->off[i];
+    hi = off + n < e->off[i] + PGSIZE ? off + n : e->off[i] + PGSIZE;
+    memmove(mem + (lo - e->off[i]), data + (lo - off), hi - lo);
+  }
+  release(&pcache.lock);
+}
+
+// Return the page holding the PGSIZE bytes of ip at offset
+// off, reading it in if it is not cached; *read says which.
+// Bytes past the end of the file read as zero.  The caller
+// gets a reference to the page (drop it with kfree()) and must
+// not write it.  Caller must hold ip's lock.  Returns 0 on
+// failure.
+static char*
+pcfind(struct inode *ip, uint off, int *read)
+{
+  struct pcent *e;
+  char *mem;
+  uint gen, n;
+  int i;
+
+  gen = 0;
+  acquire(&pcache.lock);
+  if((e = pcget(ip)) != 0){
+    for(i = 0; i < NPCPAGE; i++){
+      if(e->mem[i] && e->off[i] == off){
+        mem = e->mem[i];
+        kref(mem);
+        release(&pcache.lock);
+        *read = 0;
+        return mem;
+      }
+    }
+    gen = e->gen;
+  }
+  release(&pcache.lock);
+
+  *read = 1;
+  if((mem = ualloc(1)) == 0)
+    return 0;
+  n = 0;
+  if(off < ip->size)
+    n = ip->size - off < PGSIZE ? ip->size - off : PGSIZE;
+  if(readibuf(ip, mem, off, n) != n){
+    kfree(mem);
+    return 0;
+  }
+
+  // Don't cache a page read before an invalidation, or
+  // for an entry that has gone to another file.
+  acquire(&pcache.lock);
+  if(e && e->gen == gen && e->dev == ip->dev && e->inum == ip->inum){
+    for(i = 0; i < NPCPAGE; i++){
+      if(e->mem[i] == 0){
+        e->off[i] = off;
+        e->mem[i] = mem;
+        kref(mem);
+        break;
+      }
+    }
+  }
+  release(&pcache.lock);
+  return mem;
+}
+
+// Return the page holding the PGSIZE bytes of ip at offset
+// off, as pcfind() does, for a mapping of ip.  The caller
+// must hold a pcref() on ip and must not hold ip's lock.
+char*
+pcpage(struct inode *ip, uint off, int *read)
+{
+  char *mem;
+
+  ilock(ip);
+  mem = pcfind(ip, off, read);
+  iunlock(ip);
+  return mem;
+}
+
+// Does the cache hold the page of ip at offset off?
+int
+pchas(struct inode *ip, uint off)
+{
+  struct pcent *e;
+  int i, r;
+
+  r = 0;
+  acquire(&pcache.lock);
+  if((e = pclookup(ip)) != 0)
+    for(i = 0; i < NPCPAGE && !r; i++)
+      if(e->mem[i] && e->off[i] == off)
+        r = 1;
+  release(&pcache.lock);
+  return r;
+}
+
+// Read n bytes of regular file ip at offset off into dst,
+// for readi().  Caller must hold ip's lock and have checked
+// that the bytes lie within the file.
+int
+pcread(struct inode *ip, char *dst, uint off, uint n)
+{
+  uint tot, m;
+  char *mem;
+  int read;
+
+  for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+    if((mem = pcfind(ip, PGROUNDDOWN(off), &read)) == 0)
+      return -1;
+    m = min(n - tot, PGSIZE - off%PGSIZE);
+    memmove(dst, mem + off%PGSIZE, m);
+    kfree(mem);
+  }
+  return n;
+}
+
+// Give up to NSHRINK cached pages that no one maps back to the
+// page allocator.  Called when memory is short.  Returns the
+// number of pages freed.
+int
+pcshrink(void)
+{
+  struct pcent *e;
+  int i, n;
+
+  n = 0;
+  acquire(&pcache.lock);
+  for(e = pcache.ent; e < &pcache.ent[NINODE] && n < NSHRINK; e++){
+    for(i = 0; i < NPCPAGE && n < NSHRINK; i++){
+      if(e->mem[i] && krefcount(e->mem[i]) == 1){
+        kfree(e->mem[i]);
+        e->mem[i] = 0;
+        n++;
+      }
+    }
+  }
+  release(&pcache.lock);
+  return n;
+}
+
+// Fill in the page cache's part of m.
+void
+pcstat(struct meminfo *m)
+{
+  struct pcent *e;
+  int i;
+
+  acquire(&pcache.lock);
+  m->pcache = 0;
+  for(e = pcache.ent; e < &pcache.ent[NINODE]; e++)
+    for(i = 0; i < NPCPAGE; i++)
+      if(e->mem[i])
+        m->pcache++;
+  release(&pcache.lock);
+}
@@ -0,0 +1,94 @@
+// PCI configuration space.
+//
+// Configuration mechanism #1: write the bus, device, function
+// and register to the address port, then read or write the
+// register through the data port.  pcifind() scans every bus
+// for a device function with a given vendor and device ID or
+// class, filling in what drivers need to talk to it.
+
+#include "types.h"
+#include "defs.h"
+#include "x86.h"
+#include "pci.h"
+
+#define PCI_CONFIG_ADDR 0xcf8
+#define PCI_CONFIG_DATA 0xcfc
+
+// Configuration registers.
+#define PCI_ID          0x00  // vendor ID, device ID
+#define PCI_CMD         0x04  // command, status
+#define PCI_CLASS       0x08  // revision, prog if, subclass, class
+#define PCI_HDR         0x0c  // header type in bits 16-23
+#define PCI_BAR0        0x10
+#define PCI_INTR        0x3c  // interrupt line in bits 0-7
+
+#define PCI_CMD_IO      0x1   // respond to I/O space accesses
+#define PCI_CMD_MEM     0x2   // respond to memory space accesses
+#define PCI_CMD_MASTER  0x4   // may act as bus master (DMA)
+
+#define PCI_HDR_MULTI   0x800000  // device has several functions
+
+static uint
+pciaddr(uint bus, uint dev, uint func, uint off)
+{
+  return 0x80000000 | bus<<16 | dev<<11 | func<<8 | (off & 0xfc);
+}
+
+uint
+pciread(struct pcidev *d, uint off)
+{
+  outl(PCI_CONFIG_ADDR, pciaddr(d->bus, d->dev, d->func, off));
+  return inl(PCI_CONFIG_DATA);
+}
+
+void
+pciwrite(struct pcidev *d, uint off, uint val)
+{
+  outl(PCI_CONFIG_ADDR, pciaddr(d->bus, d->dev, d->func, off));
+  outl(PCI_CONFIG_DATA, val);
+}
+
+// Find the first device function that has the given vendor and
+// device IDs, class and subclass, any of which may be PCI_ANY,
+// and fill in d.  Returns 0 if found, -1 if not.
+int
+pcifind(int vendor, int device, int class, int subclass, struct pcidev *d)
+{
+  uint id, cl, i, nfunc;
+
+  for(d->bus = 0; d->bus < 256; d->bus++){
+    for(d->dev = 0; d->dev < 32; d->dev++){
+      nfunc = 1;
+      for(d->func = 0; d->func < nfunc; d->func++){
+        if((id = pciread(d, PCI_ID)) == 0xffffffff)
+          continue;
+        if(d->func == 0 && (pciread(d, PCI_HDR) & PCI_HDR_MULTI))
+          nfunc = 8;
+        cl = pciread(d, PCI_CLASS);
+        d->vendor = id & 0xffff;
+        d->device = id >> 16;
+        d->class = cl >> 24;
+        d->subclass = (cl >> 16) & 0xff;
+        d->progif = (cl >> 8) & 0xff;
+        if((vendor != PCI_ANY && d->vendor != vendor) ||
+           (device != PCI_ANY && d->device != device) ||
+           (class != PCI_ANY && d->class != class) ||
+           (subclass != PCI_ANY && d->subclass != subclass))
+          continue;
+        for(i = 0; i < 6; i++)
+          d->bar[i] = pciread(d, PCI_BAR0 + 4*i);
+        d->irq = pciread(d, PCI_INTR) & 0xff;
+        return 0;
+      }
+    }
+  }
+  return -1;
+}
+
+// Let d respond to I/O and memory accesses and do DMA.
+void
+pcienable(struct pcidev *d)
+{
+  pciwrite(d, PCI_CMD, (pciread(d, PCI_CMD) & 0xffff) |
+           PCI_CMD_IO | PCI_CMD_MEM | PCI_CMD_MASTER);
+}
@@ -0,0 +1,20 @@
+// A PCI device function, as found by pcifind().
+struct pcidev {
+  uint bus;
+  uint dev;
+  uint func;
+  ushort vendor;
+  ushort device;
+  uchar class;
+  uchar subclass;
+  uchar progif;
+  uchar irq;          // interrupt line
+  uint bar[6];        // base address registers
+};
+
+// Base address registers for I/O space have bit 0 set;
+// the rest is the port number.
+#define PCI_BAR_IO      0x1
+#define PCI_BAR_IOADDR(bar)  ((bar) & ~0x3)
+
+#define PCI_ANY         (-1)
@@ -6,6 +6,7 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
+#include "meminfo.h"
 #ifdef CS333_P2
 #include "uproc.h"
 #endif //CS333_P2
@@ -64,10 +65,32 @@ static void printReadyList(struct proc *, int); //also for P4
 
 static struct proc *initproc;
 
+// Address spaces of processes that wait() has collected,
+// waiting for the reaper thread to free them.
+// Protected by ptable.lock.
+static struct {
+  int on;                  // reaper thread is running
+  int head;                // next to free
+  int n;                   // number waiting
+  pde_t *pgdir[NPROC];
+} reap;
+
+// Free kernel stacks, kept by each CPU so that fork() and
+// wait() need not go to the page allocator every time.
+// Only touched by its own CPU with interrupts off.
+#define NKSTACK 4
+
+static struct {
+  int n;
+  char *stack[NKSTACK];
+} kstacks[NCPU];
+
 uint nextpid = 1;
 extern void forkret(void);
 extern void trapret(void);
 static void wakeup1(void* chan);
+static pde_t* reapvm(pde_t*);
+static void kthreadret(void);
 
   void
 pinit(void)
@@ -115,6 +138,61 @@ myproc(void) {
   return p;
 }
 
+// Lay out the top of kernel stack kstack for a new process:
+// room for the trap frame, then a context that starts executing
+// at forkret, which returns to trapret.
+static void
+kstackframe(char *kstack)
+{
+  char *sp;
+  struct context *c;
+
+  sp = kstack + KSTACKSIZE - sizeof(struct trapframe);
+  sp -= 4;
+  *(uint*)sp = (uint)trapret;
+  sp -= sizeof *c;
+  c = (struct context*)sp;
+  memset(c, 0, sizeof *c);
+  c->eip = (uint)forkret;
+}
+
+// Allocate a kernel stack, laid out by kstackframe().
+static char*
+kstackalloc(void)
+{
+  char *s;
+  int c;
+
+  s = 0;
+  pushcli();
+  c = cpuid();
+  if(kstacks[c].n > 0)
+    s = kstacks[c].stack[--kstacks[c].n];
+  popcli();
+  if(s == 0 && (s = kalloc()) != 0)
+    kstackframe(s);
+  return s;
+}
+
+// Free a kernel stack.  The frame is laid out again now,
+// while it is cheap, rather than on the next fork().
+static void
+kstackfree(char *s)
+{
+  int c;
+
+  pushcli();
+  c = cpuid();
+  if(kstacks[c].n < NKSTACK){
+    kstackframe(s);
+    kstacks[c].stack[kstacks[c].n++] = s;
+    s = 0;
+  }
+  popcli();
+  if(s)
+    kfree(s);
+}
+
 //PAGEBREAK: 32
 // Look in the process table for an UNUSED proc.
 // If found, change state to EMBRYO and initialize
@@ -153,10 +231,13 @@ allocproc(void)
   stateListAdd(&ptable.list[EMBRYO], p);
 #endif
   p->pid = nextpid++;
+  p->vmbusy = 0;
+  p->minflt = p->majflt = p->cowflt = 0;
   release(&ptable.lock);
 
   // Allocate kernel stack.
-  if((p->kstack = kalloc()) == 0){
+  if((p->kstack = kstackalloc()) == 0){
+    acquire(&ptable.lock);
 #ifdef CS333_P3
     if(stateListRemove(&ptable.list[EMBRYO], p) == -1)
       panic("\nFailed to remove from EMBRYO list after kernel stack allocation failure in allocproc()\n");
@@ -169,21 +250,13 @@ allocproc(void)
 #endif
     return 0;
   }
+  // The trap frame and a context that starts executing
+  // at forkret are already laid out at the top of the stack.
   sp = p->kstack + KSTACKSIZE;
-
-  // Leave room for trap frame.
   sp -= sizeof *p->tf;
   p->tf = (struct trapframe*)sp;
-
-  // Set up new context to start executing at forkret,
-  // which returns to trapret.
-  sp -= 4;
-  *(uint*)sp = (uint)trapret;
-
-  sp -= sizeof *p->context;
+  sp -= 4 + sizeof *p->context;
   p->context = (struct context*)sp;
-  memset(p->context, 0, sizeof *p->context);
-  p->context->eip = (uint)forkret;
 
   //To initialize the start_ticks
   p->start_ticks = ticks;
@@ -213,28 +286,22 @@ allocproc(void)
   }
   p->state = EMBRYO;
   p->pid = nextpid++;
+  p->vmbusy = 0;
+  p->minflt = p->majflt = p->cowflt = 0;
   release(&ptable.lock);
 
   // Allocate kernel stack.
-  if((p->kstack = kalloc()) == 0){
+  if((p->kstack = kstackalloc()) == 0){
     p->state = UNUSED;
     return 0;
   }
+  // The trap frame and a context that starts executing
+  // at forkret are already laid out at the top of the stack.
   sp = p->kstack + KSTACKSIZE;
-
-  // Leave room for trap frame.
   sp -= sizeof *p->tf;
   p->tf = (struct trapframe*)sp;
-
-  // Set up new context to start executing at forkret,
-  // which returns to trapret.
-  sp -= 4;
-  *(uint*)sp = (uint)trapret;
-
-  sp -= sizeof *p->context;
+  sp -= 4 + sizeof *p->context;
   p->context = (struct context*)sp;
-  memset(p->context, 0, sizeof *p->context);
-  p->context->eip = (uint)forkret;
 
   //To initialize the start_ticks
   p->start_ticks = ticks;
@@ -300,6 +367,41 @@ userinit(void)
   release(&ptable.lock);
 }
 
+// Start a kernel thread called name running fn, which must
+// never return.  Kernel threads have no user memory; they run
+// on kpgdir and are scheduled like any other process.
+struct proc*
+kthread(char *name, void (*fn)(void))
+{
+  struct proc *p;
+  extern pde_t *kpgdir;
+
+  if((p = allocproc()) == 0)
+    panic("kthread");
+  p->pgdir = kpgdir;
+  // allocproc() arranged for the thread to start in forkret()
+  // and return to trapret; start in kthreadret() and return
+  // to fn instead.
+  p->context->eip = (uint)kthreadret;
+  *(uint*)(p->context + 1) = (uint)fn;
+  safestrcpy(p->name, name, sizeof(p->name));
+
+  acquire(&ptable.lock);
+#ifdef CS333_P3
+  if(stateListRemove(&ptable.list[EMBRYO], p) == -1)
+    panic("\nFailed to remove from EMBRYO list in kthread()\n");
+  assertState(p, EMBRYO, __FUNCTION__, __LINE__);
+#endif
+  p->state = RUNNABLE;
+#ifdef CS333_P4
+  stateListAdd(&ptable.ready[p->priority], p);
+#elif CS333_P3
+  stateListAdd(&ptable.list[RUNNABLE], p);
+#endif
+  release(&ptable.lock);
+  return p;
+}
+
 // Grow current process's memory by n bytes.
 // Return 0 on success, -1 on failure.
 int
@@ -310,6 +412,9 @@ growproc(int n)
 
   sz = curproc->sz;
   if(n > 0){
+    // Don't grow into an mmap() region.
+    if(vmaoverlap(curproc->vma, PGROUNDUP(sz), PGROUNDUP(sz + n)))
+      return -1;
     if((sz = allocuvm(curproc->pgdir, sz, sz + n)) == 0)
       return -1;
   } else if(n < 0){
@@ -337,9 +442,11 @@ fork(void)
     return -1;
   }
 
-  // Copy process state from proc.
-  if((np->pgdir = copyuvm(curproc->pgdir, curproc->sz)) == 0){
-    kfree(np->kstack);
+  // Copy process state from proc.  Keep the parent's pages
+  // in memory while copying; syscall() clears vmbusy.
+  curproc->vmbusy = 1;
+  if((np->pgdir = copyuvm(curproc->pgdir)) == 0){
+    kstackfree(np->kstack);
     np->kstack = 0;
 #ifdef CS333_P3
     acquire(&ptable.lock);
@@ -370,6 +477,7 @@ fork(void)
       np->ofile[i] = filedup(curproc->ofile[i]);
   }
   np->cwd = idup(curproc->cwd);
+  vmadup(np->vma, curproc->vma);
 
   safestrcpy(np->name, curproc->name, sizeof(curproc->name));
 
@@ -392,6 +500,75 @@ fork(void)
   return pid;
 }
 
+// Create a new process running the program in path with
+// arguments argv, without first copying the caller as fork()
+// would.  The child's file descriptors 0, 1 and 2 are copies
+// of the caller's fds[0], fds[1] and fds[2] (closed if -1);
+// it gets no other open files.  Returns the child's pid, or -1.
+int
+spawn(char *path, char **argv, int *fds)
+{
+  int i;
+  uint pid;
+  struct proc *np;
+  struct proc *curproc = myproc();
+
+  for(i = 0; i < 3; i++)
+    if(fds[i] != -1 &&
+       (fds[i] < 0 || fds[i] >= NOFILE || curproc->ofile[fds[i]] == 0))
+      return -1;
+
+  if((np = allocproc()) == 0)
+    return -1;
+  np->pgdir = 0;
+  memset(np->vma, 0, sizeof(np->vma));
+  *np->tf = *curproc->tf;
+  if(execinto(np, path, argv) < 0){
+    kstackfree(np->kstack);
+    np->kstack = 0;
+    acquire(&ptable.lock);
+#ifdef CS333_P3
+    if(stateListRemove(&ptable.list[EMBRYO], np) == -1)
+      panic("\nFailed to remove from EMBRYO list in spawn() after exec failure\n");
+    assertState(np, EMBRYO, __FUNCTION__, __LINE__);
+#endif
+    np->state = UNUSED;
+#ifdef CS333_P3
+    stateListAdd(&ptable.list[UNUSED], np);
+#endif
+    release(&ptable.lock);
+    return -1;
+  }
+  np->parent = curproc;
+#ifdef CS333_P2
+  np->uid = curproc->uid;
+  np->gid = curproc->gid;
+#endif	//CS333_P2
+
+  for(i = 0; i < 3; i++)
+    if(fds[i] != -1)
+      np->ofile[i] = filedup(curproc->ofile[fds[i]]);
+  np->cwd = idup(curproc->cwd);
+
+  pid = np->pid;
+
+  acquire(&ptable.lock);
+#ifdef CS333_P3
+  if(stateListRemove(&ptable.list[EMBRYO], np) == -1)
+    panic("\nFailed to remove from EMBRYO list in spawn()\n");
+  assertState(np, EMBRYO, __FUNCTION__, __LINE__);
+#endif
+  np->state = RUNNABLE;
+#ifdef CS333_P4
+  stateListAdd(&ptable.ready[np->priority], np);
+#elif CS333_P3
+  stateListAdd(&ptable.list[RUNNABLE], np);
+#endif
+  release(&ptable.lock);
+
+  return pid;
+}
+
 // Exit the current process.  Does not return.
 // An exited process remains in the zombie state
 // until its parent calls wait() to find out it exited.
@@ -413,8 +590,9 @@ exit(void)
       curproc->ofile[fd] = 0;
     }
   }
+  vmafree(curproc->pgdir, curproc->vma);
 
-  begin_op();
+  begin_op(OP_IPUT);
   iput(curproc->cwd);
   end_op();
   curproc->cwd = 0;
@@ -479,8 +657,9 @@ exit(void)
       curproc->ofile[fd] = 0;
     }
   }
+  vmafree(curproc->pgdir, curproc->vma);
 
-  begin_op();
+  begin_op(OP_IPUT);
   iput(curproc->cwd);
   end_op();
   curproc->cwd = 0;
@@ -532,8 +711,9 @@ exit(void)
       curproc->ofile[fd] = 0;
     }
   }
+  vmafree(curproc->pgdir, curproc->vma);
 
-  begin_op();
+  begin_op(OP_IPUT);
   iput(curproc->cwd);
   end_op();
   curproc->cwd = 0;
@@ -570,6 +750,7 @@ wait(void){
   struct proc *p;
   int havekids;
   uint pid;
+  pde_t *pgdir;
   struct proc *curproc = myproc();
 
   acquire(&ptable.lock);
@@ -587,9 +768,10 @@ wait(void){
         if(p->state == ZOMBIE){
           // Found one.
           pid = p->pid;
-          kfree(p->kstack);
+          kstackfree(p->kstack);
           p->kstack = 0;
-          freevm(p->pgdir);
+          pgdir = reapvm(p->pgdir);
+          p->pgdir = 0;
           p->pid = 0;
           p->parent = 0;
           p->name[0] = 0;
@@ -600,6 +782,8 @@ wait(void){
           p->state = UNUSED;
           stateListAdd(&ptable.list[UNUSED], p);
           release(&ptable.lock);
+          if(pgdir)
+            freevm(pgdir);
           return pid;
         }
         p = p->next;
@@ -619,9 +803,10 @@ wait(void){
         if(p->state == ZOMBIE){
           // Found one.
           pid = p->pid;
-          kfree(p->kstack);
+          kstackfree(p->kstack);
           p->kstack = 0;
-          freevm(p->pgdir);
+          pgdir = reapvm(p->pgdir);
+          p->pgdir = 0;
           p->pid = 0;
           p->parent = 0;
           p->name[0] = 0;
@@ -632,6 +817,8 @@ wait(void){
           p->state = UNUSED;
           stateListAdd(&ptable.list[UNUSED], p);
           release(&ptable.lock);
+          if(pgdir)
+            freevm(pgdir);
           return pid;
         }
         p = p->next;
@@ -656,6 +843,7 @@ wait(void)
   struct proc *p;
   int havekids;
   uint pid;
+  pde_t *pgdir;
   struct proc *curproc = myproc();
 
   acquire(&ptable.lock);
@@ -669,15 +857,18 @@ wait(void)
       if(p->state == ZOMBIE){
         // Found one.
         pid = p->pid;
-        kfree(p->kstack);
+        kstackfree(p->kstack);
         p->kstack = 0;
-        freevm(p->pgdir);
+        pgdir = reapvm(p->pgdir);
+        p->pgdir = 0;
         p->pid = 0;
         p->parent = 0;
         p->name[0] = 0;
         p->killed = 0;
         p->state = UNUSED;
         release(&ptable.lock);
+        if(pgdir)
+          freevm(pgdir);
         return pid;
       }
     }
@@ -694,6 +885,50 @@ wait(void)
 }
 #endif
 
+// Free the address space of a process that wait() has just
+// collected.  Normally hands it to the reaper thread, so that
+// wait() need not spend the time, and returns 0.  If the
+// reaper is not running or is too far behind, returns pgdir
+// for wait() to free itself once it has released ptable.lock:
+// freevm() takes other locks, such as swap's, that must not
+// be taken while holding ptable.lock.
+// Caller must hold ptable.lock.
+static pde_t*
+reapvm(pde_t *pgdir)
+{
+  if(!reap.on || reap.n == NELEM(reap.pgdir))
+    return pgdir;
+  reap.pgdir[(reap.head + reap.n) % NELEM(reap.pgdir)] = pgdir;
+  reap.n++;
+  wakeup1(&reap);
+  return 0;
+}
+
+// The reaper kernel thread: free the address spaces queued
+// by reapvm(), a batch at a time, without holding ptable.lock.
+void
+reaper(void)
+{
+  pde_t *batch[NELEM(reap.pgdir)];
+  int i, n;
+
+  acquire(&ptable.lock);
+  reap.on = 1;
+  for(;;){
+    while(reap.n == 0)
+      sleep(&reap, &ptable.lock);
+    for(n = 0; reap.n > 0; n++){
+      batch[n] = reap.pgdir[reap.head];
+      reap.head = (reap.head + 1) % NELEM(reap.pgdir);
+      reap.n--;
+    }
+    release(&ptable.lock);
+    for(i = 0; i < n; i++)
+      freevm(batch[i]);
+    acquire(&ptable.lock);
+  }
+}
+
 //PAGEBREAK: 42
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
@@ -766,8 +1001,9 @@ scheduler(void)
     }
     release(&ptable.lock);
 #ifdef PDX_XV6
-    // if idle, wait for next interrupt
-    if (idle) {
+    // if idle, zero a free page for kzalloc(), or if there
+    // is nothing to do, wait for next interrupt
+    if (idle && !kzfill()) {
       sti();
       hlt();
     }
@@ -834,8 +1070,9 @@ scheduler(void)
     }
     release(&ptable.lock);
 #ifdef PDX_XV6
-    // if idle, wait for next interrupt
-    if (idle) {
+    // if idle, zero a free page for kzalloc(), or if there
+    // is nothing to do, wait for next interrupt
+    if (idle && !kzfill()) {
       sti();
       hlt();
     }
@@ -885,8 +1122,9 @@ scheduler(void)
     }
     release(&ptable.lock);
 #ifdef PDX_XV6
-    // if idle, wait for next interrupt
-    if (idle) {
+    // if idle, zero a free page for kzalloc(), or if there
+    // is nothing to do, wait for next interrupt
+    if (idle && !kzfill()) {
       sti();
       hlt();
     }
@@ -1000,6 +1238,15 @@ forkret(void)
   // Return to "caller", actually trapret (see allocproc).
 }
 
+// A kernel thread's first scheduling swtches here.
+// "Return" to the thread's function (see kthread).
+static void
+kthreadret(void)
+{
+  // Still holding ptable.lock from scheduler.
+  release(&ptable.lock);
+}
+
 // Atomically release lock and sleep on chan.
 // Reacquires lock when awakened.
 #ifdef CS333_P3
@@ -1256,6 +1503,66 @@ kill(int pid)
 }
 #endif
 
+// Choose a user page to page out to swap slot, and make its
+// PTE refer to the slot.  A clock hand sweeps over the
+// processes and, within each, over its address space (see
+// vmclock()); two laps are enough to find a page if there is
+// one.  Processes that are running elsewhere, or whose pages
+// the kernel is using, are skipped.  Returns the page, which
+// the caller must write out and free, or 0 if there is none.
+char*
+swapvictim(uint slot)
+{
+  static int hand;
+  static uint va;
+  struct proc *p;
+  char *mem;
+  int i;
+
+  acquire(&ptable.lock);
+  for(i = 0; i < 2*NPROC + 1; i++){
+    p = &ptable.proc[hand];
+    if((p->state == RUNNABLE || p->state == SLEEPING ||
+        (p->state == RUNNING && p == myproc())) &&
+       p->pgdir && !p->vmbusy){
+      mem = vmclock(p->pgdir, &va, slot);
+      if(p == myproc())
+        lcr3(V2P(p->pgdir));  // PTE_A and the victim's PTE changed
+      if(mem){
+        release(&ptable.lock);
+        return mem;
+      }
+    }
+    hand = (hand + 1) % NPROC;
+    va = 0;
+  }
+  release(&ptable.lock);
+  return 0;
+}
+
+// Fill in the kernel stack and page table parts of m.
+void
+procmemstat(struct meminfo *m)
+{
+  struct proc *p;
+  uint rss, swapped, pt;
+  int i;
+
+  m->kstack = m->pgtab = 0;
+  acquire(&ptable.lock);
+  for(p = ptable.proc; p < &ptable.proc[NPROC]; p++){
+    if(p->kstack)
+      m->kstack++;
+    if(p->state != UNUSED && p->pgdir){
+      vmusage(p->pgdir, &rss, &swapped, &pt);
+      m->pgtab += pt;
+    }
+  }
+  for(i = 0; i < ncpu; i++)
+    m->kstack += kstacks[i].n;
+  release(&ptable.lock);
+}
+
 //PAGEBREAK: 36
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
@@ -1368,6 +1675,7 @@ procdump(void)
     }
     cprintf("\n");
   }
+  swapdump();
 #ifdef CS333_P1
   cprintf("$ ");  // simulate shell prompt
 #endif // CS333_P1
@@ -1666,6 +1974,15 @@ getstheprocs(uint max, struct uproc* table)
       table[procs_copied].CPU_total_ticks = p->cpu_ticks_total;
       safestrcpy(table[procs_copied].state, states[p->state], STRMAX);
       table[procs_copied].size = p->sz;
+      if(p->pgdir)
+        vmusage(p->pgdir, &table[procs_copied].rss,
+                &table[procs_copied].swapped, &table[procs_copied].ptpages);
+      else
+        table[procs_copied].rss = table[procs_copied].swapped =
+          table[procs_copied].ptpages = 0;
+      table[procs_copied].minflt = p->minflt;
+      table[procs_copied].majflt = p->majflt;
+      table[procs_copied].cowflt = p->cowflt;
       table[procs_copied].priority = p->priority;
       safestrcpy(table[procs_copied].name, p->name, sizeof(p->name));
 
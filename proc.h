@@ -32,6 +32,21 @@ struct context {
   uint eip;
 };
 
+// A region of user memory whose pages are filled in the first
+// time they are touched (see pagefault() in vm.c): read from a
+// file, or zero-filled past filesz up to end.  exec() creates
+// one for each program segment and mmap() one per call.
+struct vma {
+  uint start;                  // First virtual address (page aligned)
+  uint end;                    // One past the last virtual address
+  int flags;                   // MAP_* flags; 0 if the slot is unused
+  struct inode *ip;            // Backing file; 0 if anonymous
+  struct shm *shm;             // Attached shared memory segment, or 0
+  uint off;                    // File offset corresponding to start
+  uint filesz;                 // Bytes from start that come from the file
+  int perm;                    // PTE permission bits for the pages
+};
+
 enum procstate { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
@@ -49,6 +64,13 @@ struct proc {
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;           // Current directory
   char name[16];               // Process name (debugging)
+  struct vma vma[NVMA];        // Mapped regions
+  int vmbusy;                  // If non-zero, kernel is using user pages; don't swap them
+  int oplog;                   // Log blocks reserved by begin_op()
+  int opdata;                  // File data blocks reserved by begin_opdata()
+  uint minflt;                 // Page faults served from memory
+  uint majflt;                 // Page faults that read from disk
+  uint cowflt;                 // Copy-on-write breaks
   uint start_ticks;            // To keep track of system Ticks
   uint cpu_ticks_total;        // Total elapsed ticks in CPU
   uint cpu_ticks_in;           // Ticks when scheduled
@@ -15,7 +15,7 @@ main(int argc, char* argv[])
 
   if(active_processes < 0)
     printf(2, "There are no processes to display.");
-  printf(1,"\nPID\tName\tUID\tGID\tPPID\tPrio\tElapsed\tCPU\tState\tSize\t\n");
+  printf(1,"\nPID\tName\tUID\tGID\tPPID\tPrio\tElapsed\tCPU\tState\tSize\tRSS\tSwap\tPT\tMinFlt\tMajFlt\tCOW\n");
   for(int i = 0 ; i < active_processes ; ++i)
   {
     int j = 0;
@@ -58,9 +58,15 @@ main(int argc, char* argv[])
     else if(cpu_milliseconds < 10)
       printf(1,".00%d\t", cpu_milliseconds);
 
-    printf(1,"%s\t%d\n",
+    printf(1,"%s\t%d\t%d\t%d\t%d\t%d\t%d\t%d\n",
         table[i].state,
-        table[i].size
+        table[i].size,
+        table[i].rss,
+        table[i].swapped,
+        table[i].ptpages,
+        table[i].minflt,
+        table[i].majflt,
+        table[i].cowflt
         );
   }
 
@@ -53,6 +53,7 @@ struct backcmd {
 int fork1(void);  // Fork but panics on failure.
 void panic(char*);
 struct cmd *parsecmd(char*);
+void freecmd(struct cmd*);
 
 // Execute cmd.  Never returns.
 void
@@ -131,6 +132,79 @@ runcmd(struct cmd *cmd)
   exit();
 }
 
+// Can cmd be run with spawn()?  Simple commands, with
+// redirections, and pipelines of them can.
+int
+spawnable(struct cmd *cmd)
+{
+  switch(cmd->type){
+  case EXEC:
+    return 1;
+  case REDIR:
+    return spawnable(((struct redircmd*)cmd)->cmd);
+  case PIPE:
+    return spawnable(((struct pipecmd*)cmd)->left) &&
+           spawnable(((struct pipecmd*)cmd)->right);
+  }
+  return 0;
+}
+
+// Start the programs of spawnable cmd, with file descriptors
+// 0, 1 and 2 taken from fds, without forking the shell.
+// Returns the number of processes started.
+int
+spawncmd(struct cmd *cmd, int *fds)
+{
+  int p[2], fd, n;
+  struct execcmd *ecmd;
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+
+  switch(cmd->type){
+  case EXEC:
+    ecmd = (struct execcmd*)cmd;
+    if(ecmd->argv[0] == 0)
+      return 0;
+    if(spawn(ecmd->argv[0], ecmd->argv, fds) < 0){
+      printf(2, "exec %s failed\n", ecmd->argv[0]);
+      return 0;
+    }
+    return 1;
+
+  case REDIR:
+    rcmd = (struct redircmd*)cmd;
+    if((fd = open(rcmd->file, rcmd->mode)) < 0){
+      printf(2, "open %s failed\n", rcmd->file);
+      return 0;
+    }
+    p[0] = fds[rcmd->fd];
+    fds[rcmd->fd] = fd;
+    n = spawncmd(rcmd->cmd, fds);
+    fds[rcmd->fd] = p[0];
+    close(fd);
+    return n;
+
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    if(pipe(p) < 0){
+      printf(2, "pipe failed\n");
+      return 0;
+    }
+    fd = fds[1];
+    fds[1] = p[1];
+    n = spawncmd(pcmd->left, fds);
+    fds[1] = fd;
+    fd = fds[0];
+    fds[0] = p[0];
+    n += spawncmd(pcmd->right, fds);
+    fds[0] = fd;
+    close(p[0]);
+    close(p[1]);
+    return n;
+  }
+  return 0;
+}
+
 int
 getcmd(char *buf, int nbuf)
 {
@@ -218,7 +292,8 @@ int
 main(void)
 {
   static char buf[100];
-  int fd;
+  int fd, n, fds[3];
+  struct cmd *cmd;
 
   // Assumes three file descriptors open.
   while((fd = open("console", O_RDWR)) >= 0){
@@ -251,9 +326,20 @@ main(void)
       continue;
     }
 #endif
-    if(fork1() == 0)
-      runcmd(parsecmd(buf));
-    wait();
+    if((cmd = parsecmd(buf)) == 0)
+      continue;
+    if(spawnable(cmd)){
+      fds[0] = 0;
+      fds[1] = 1;
+      fds[2] = 2;
+      for(n = spawncmd(cmd, fds); n > 0; n--)
+        wait();
+    } else {
+      if(fork1() == 0)
+        runcmd(cmd);
+      wait();
+    }
+    freecmd(cmd);
   }
   exit();
 }
@@ -411,18 +497,35 @@ struct cmd *parsepipe(char**, char*);
 struct cmd *parseexec(char**, char*);
 struct cmd *nulterminate(struct cmd*);
 
+// The shell parses commands itself, so a syntax error must
+// not exit; syntax() notes it and parsecmd() returns 0.
+int parseerr;
+
+void
+syntax(char *msg)
+{
+  if(!parseerr)
+    printf(2, "%s\n", msg);
+  parseerr = 1;
+}
+
 struct cmd*
 parsecmd(char *s)
 {
   char *es;
   struct cmd *cmd;
 
+  parseerr = 0;
   es = s + strlen(s);
   cmd = parseline(&s, es);
   peek(&s, es, "");
-  if(s != es){
+  if(s != es && !parseerr){
     printf(2, "leftovers: %s\n", s);
-    panic("syntax");
+    syntax("syntax");
+  }
+  if(parseerr){
+    freecmd(cmd);
+    return 0;
   }
   nulterminate(cmd);
   return cmd;
@@ -466,8 +569,10 @@ parseredirs(struct cmd *cmd, char **ps, char *es)
 
   while(peek(ps, es, "<>")){
     tok = gettoken(ps, es, 0, 0);
-    if(gettoken(ps, es, &q, &eq) != 'a')
-      panic("missing file for redirection");
+    if(gettoken(ps, es, &q, &eq) != 'a'){
+      syntax("missing file for redirection");
+      break;
+    }
     switch(tok){
     case '<':
       cmd = redircmd(cmd, q, eq, O_RDONLY, 0);
@@ -492,8 +597,10 @@ parseblock(char **ps, char *es)
     panic("parseblock");
   gettoken(ps, es, 0, 0);
   cmd = parseline(ps, es);
-  if(!peek(ps, es, ")"))
-    panic("syntax - missing )");
+  if(!peek(ps, es, ")")){
+    syntax("syntax - missing )");
+    return cmd;
+  }
   gettoken(ps, es, 0, 0);
   cmd = parseredirs(cmd, ps, es);
   return cmd;
@@ -518,13 +625,17 @@ parseexec(char **ps, char *es)
   while(!peek(ps, es, "|)&;")){
     if((tok=gettoken(ps, es, &q, &eq)) == 0)
       break;
-    if(tok != 'a')
-      panic("syntax");
+    if(tok != 'a'){
+      syntax("syntax");
+      break;
+    }
+    if(argc >= MAXARGS-1){
+      syntax("too many args");
+      break;
+    }
     cmd->argv[argc] = q;
     cmd->eargv[argc] = eq;
     argc++;
-    if(argc >= MAXARGS)
-      panic("too many args");
     ret = parseredirs(ret, ps, es);
   }
   cmd->argv[argc] = 0;
@@ -578,3 +689,32 @@ nulterminate(struct cmd *cmd)
   }
   return cmd;
 }
+
+// Free a parsed command.
+void
+freecmd(struct cmd *cmd)
+{
+  if(cmd == 0)
+    return;
+
+  switch(cmd->type){
+  case REDIR:
+    freecmd(((struct redircmd*)cmd)->cmd);
+    break;
+
+  case PIPE:
+    freecmd(((struct pipecmd*)cmd)->left);
+    freecmd(((struct pipecmd*)cmd)->right);
+    break;
+
+  case LIST:
+    freecmd(((struct listcmd*)cmd)->left);
+    freecmd(((struct listcmd*)cmd)->right);
+    break;
+
+  case BACK:
+    freecmd(((struct backcmd*)cmd)->cmd);
+    break;
+  }
+  free(cmd);
+}
@@ -0,0 +1,211 @@
+// Shared memory segments.
+//
+// A segment is a set of physical pages with a key.  shmget()
+// finds the segment with a given key, creating it if need be;
+// shmat() maps all of its pages into the calling process (see
+// vmashm() in vm.c).  Processes that attach the same segment
+// see each other's writes directly, with no copying.
+//
+// Each region that maps a segment holds a reference to it;
+// fork() gives the child its own.  The pages themselves are
+// reference counted by kalloc.c, so freevm() releases a
+// process's mappings like any other page.  A segment lives
+// until shmrm() marks it removed and the last region that
+// maps it goes away.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "spinlock.h"
+#include "meminfo.h"
+
+struct shm {
+  int key;                 // 0 for a private segment
+  int npages;              // 0 if this slot is free
+  int ref;                 // regions attached to it
+  int removed;             // shmrm() has been called
+  int busy;                // shmget() is allocating the pages
+  char *pages[SHMPAGES];
+};
+
+struct {
+  struct spinlock lock;
+  struct shm seg[NSHM];
+} shmtab;
+
+void
+shminit(void)
+{
+  initlock(&shmtab.lock, "shm");
+}
+
+// Free the pages of s.  Caller must hold shmtab.lock.
+static void
+shmfree(struct shm *s)
+{
+  int i;
+
+  for(i = 0; i < s->npages; i++){
+    kfree(s->pages[i]);
+    s->pages[i] = 0;
+  }
+  s->npages = 0;
+  s->key = 0;
+  s->removed = 0;
+}
+
+// Find the segment with key, other than a private one.
+// Caller must hold shmtab.lock.
+static struct shm*
+shmfind(int key)
+{
+  struct shm *s;
+
+  if(key == 0)
+    return 0;
+  for(s = shmtab.seg; s < &shmtab.seg[NSHM]; s++)
+    if(s->npages > 0 && s->key == key && !s->removed)
+      return s;
+  return 0;
+}
+
+// Return the id of the segment with key, creating it with
+// size bytes of zeroed memory if there is none.  Key 0
+// always creates a new segment.  Returns -1 if a segment
+// exists but is smaller than size, or on lack of resources.
+int
+shmget(int key, uint size)
+{
+  struct shm *s, *t;
+  int i, n;
+
+  n = PGROUNDUP(size) / PGSIZE;
+  if(size == 0 || n > SHMPAGES)
+    return -1;
+
+  acquire(&shmtab.lock);
+  if((t = shmfind(key)) != 0){
+    release(&shmtab.lock);
+    return t->npages >= n ? t - shmtab.seg : -1;
+  }
+  for(s = shmtab.seg; s < &shmtab.seg[NSHM]; s++)
+    if(s->npages == 0 && !s->busy)
+      break;
+  if(s == &shmtab.seg[NSHM]){
+    release(&shmtab.lock);
+    return -1;
+  }
+  s->busy = 1;
+  release(&shmtab.lock);
+
+  // Allocate the pages without holding the lock, so that
+  // ualloc() can make room if memory is short.
+  for(i = 0; i < n; i++)
+    if((s->pages[i] = ualloc(1)) == 0)
+      break;
+
+  acquire(&shmtab.lock);
+  s->busy = 0;
+  // Another shmget() may have created the segment meanwhile.
+  if(i < n || (t = shmfind(key)) != 0){
+    s->npages = i;
+    shmfree(s);
+    release(&shmtab.lock);
+    if(i < n || t->npages < n)
+      return -1;
+    return t - shmtab.seg;
+  }
+  s->key = key;
+  s->npages = n;
+  s->ref = 0;
+  release(&shmtab.lock);
+  return s - shmtab.seg;
+}
+
+// Take a reference to segment id for a new region and set
+// *size to its size.  Returns 0 if there is no such segment.
+struct shm*
+shmlookup(int id, uint *size)
+{
+  struct shm *s;
+
+  if(id < 0 || id >= NSHM)
+    return 0;
+  acquire(&shmtab.lock);
+  s = &shmtab.seg[id];
+  if(s->npages == 0 || s->removed){
+    release(&shmtab.lock);
+    return 0;
+  }
+  s->ref++;
+  *size = s->npages * PGSIZE;
+  release(&shmtab.lock);
+  return s;
+}
+
+// Return page i of s, with a reference for the caller's
+// mapping.  The caller must hold a reference to s.
+char*
+shmpage(struct shm *s, int i)
+{
+  kref(s->pages[i]);
+  return s->pages[i];
+}
+
+// Take another reference to s.
+void
+shmdup(struct shm *s)
+{
+  acquire(&shmtab.lock);
+  s->ref++;
+  release(&shmtab.lock);
+}
+
+// Drop a reference to s, freeing it if it has been removed
+// and nothing maps it any more.
+void
+shmput(struct shm *s)
+{
+  acquire(&shmtab.lock);
+  if(s->ref < 1)
+    panic("shmput");
+  if(--s->ref == 0 && s->removed)
+    shmfree(s);
+  release(&shmtab.lock);
+}
+
+// Remove segment id: no more shmget() or shmat() will find
+// it, and it goes away with its last mapping.
+int
+shmrm(int id)
+{
+  struct shm *s;
+
+  if(id < 0 || id >= NSHM)
+    return -1;
+  acquire(&shmtab.lock);
+  s = &shmtab.seg[id];
+  if(s->npages == 0 || s->removed){
+    release(&shmtab.lock);
+    return -1;
+  }
+  s->removed = 1;
+  if(s->ref == 0)
+    shmfree(s);
+  release(&shmtab.lock);
+  return 0;
+}
+
+// Fill in the shared memory part of m.
+void
+shmstat(struct meminfo *m)
+{
+  struct shm *s;
+
+  acquire(&shmtab.lock);
+  m->shm = 0;
+  for(s = shmtab.seg; s < &shmtab.seg[NSHM]; s++)
+    m->shm += s->npages;
+  release(&shmtab.lock);
+}
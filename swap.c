@@ -0,0 +1,225 @@
+// Paging user memory out to disk.
+//
+// The root disk has a swap area of SWAPSIZE blocks after the
+// file system, divided into page-sized slots.  When ualloc()
+// can't find a free page for user memory it calls swapout(),
+// which asks swapvictim() (proc.c) for a page that no one has
+// used lately, writes it to a free slot and frees it.  The
+// page's PTE keeps its flags but has PTE_SWAP in place of
+// PTE_P and the slot number in place of the physical address.
+// A later access faults, and pagefault() reads the page back
+// in with swapread().
+//
+// fork() shares slots between parent and child, so each
+// slot has a reference count.  A slot is busy while its page
+// is being written out; anyone who wants to read it waits.
+// They wait under busylock rather than lock: sleep() and
+// wakeup() take ptable.lock, and wait() can free an address
+// space, and so call swapfree(), while holding ptable.lock.
+// So lock must never be held while taking ptable.lock.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "meminfo.h"
+
+#define NSLOT   (SWAPSIZE/(PGSIZE/BSIZE))
+
+struct {
+  struct spinlock lock;
+  struct spinlock busylock; // for waiting until busy[slot] clears
+  int nslot;               // slots on disk; 0 if there's no swap area
+  int nused;               // slots in use
+  uint nout;               // pages written out
+  uint nin;                // pages read back in
+  uchar ref[NSLOT];        // references to each slot
+  uchar busy[NSLOT];       // slot is being written; set under
+                           // lock, cleared under busylock
+  struct buf buf;          // for swap i/o; protected by buf.lock
+  uchar data[BSIZE];       // buf's data
+} swap;
+
+void
+swapinit(void)
+{
+  int n;
+
+  initlock(&swap.lock, "swap");
+  initlock(&swap.busylock, "swap busy");
+  initsleeplock(&swap.buf.lock, "swap buffer");
+  swap.buf.data = swap.data;
+  n = idesize(ROOTDEV) - FSSIZE;
+  if(n > SWAPSIZE)
+    n = SWAPSIZE;
+  if(n > 0)
+    swap.nslot = n / (PGSIZE/BSIZE);
+}
+
+// Read or write the page at mem from or to slot.
+static void
+swaprw(uint slot, char *mem, int write)
+{
+  struct buf *b;
+  int i;
+
+  b = &swap.buf;
+  acquiresleep(&b->lock);
+  b->dev = ROOTDEV;
+  for(i = 0; i < PGSIZE/BSIZE; i++){
+    b->blockno = FSSIZE + slot*(PGSIZE/BSIZE) + i;
+    if(write){
+      memmove(b->data, mem + i*BSIZE, BSIZE);
+      b->flags = B_DIRTY;
+    } else
+      b->flags = 0;
+    iderw(b);
+    if(!write)
+      memmove(mem + i*BSIZE, b->data, BSIZE);
+  }
+  releasesleep(&b->lock);
+}
+
+// Can the caller sleep?  Not if it holds a spin lock.
+static int
+cansleep(void)
+{
+  int ok;
+
+  pushcli();
+  ok = myproc() != 0 && mycpu()->ncli == 1;
+  popcli();
+  return ok;
+}
+
+// Page out one user page and free it.
+// Returns 0 on success, -1 if there was nothing to page out.
+static int
+swapout(void)
+{
+  char *mem;
+  int slot;
+
+  acquire(&swap.lock);
+  for(slot = 0; slot < swap.nslot; slot++)
+    if(swap.ref[slot] == 0 && !swap.busy[slot])
+      break;
+  if(slot == swap.nslot){
+    release(&swap.lock);
+    return -1;
+  }
+  swap.ref[slot] = 1;
+  swap.busy[slot] = 1;
+  swap.nused++;
+  release(&swap.lock);
+
+  if((mem = swapvictim(slot)) == 0){
+    acquire(&swap.lock);
+    swap.ref[slot] = 0;
+    swap.busy[slot] = 0;
+    swap.nused--;
+    release(&swap.lock);
+    return -1;
+  }
+  swaprw(slot, mem, 1);
+  kfree(mem);
+
+  acquire(&swap.lock);
+  swap.nout++;
+  release(&swap.lock);
+  acquire(&swap.busylock);
+  swap.busy[slot] = 0;
+  wakeup(&swap.busy[slot]);
+  release(&swap.busylock);
+  return 0;
+}
+
+// Allocate a page of user memory, zeroed if zero is set.
+// If memory is short, shrink the page and buffer caches or
+// page out other pages to make room, and have the log commit
+// so that its blocks can leave the buffer cache.
+// Returns 0 if that can't be done.
+char*
+ualloc(int zero)
+{
+  char *mem;
+
+  for(;;){
+    if((mem = zero ? kzalloc() : kalloc()) != 0)
+      return mem;
+    if(pcshrink() > 0 || bshrink() > 0)
+      continue;
+    logkick();
+    if(!cansleep() || swapout() < 0)
+      return 0;
+  }
+}
+
+// Read the page in slot into mem, waiting for it to finish
+// being written out if need be.  The caller holds a
+// reference to the slot.
+void
+swapread(uint slot, char *mem)
+{
+  acquire(&swap.lock);
+  if(slot >= swap.nslot || swap.ref[slot] == 0)
+    panic("swapread");
+  swap.nin++;
+  release(&swap.lock);
+  acquire(&swap.busylock);
+  while(swap.busy[slot])
+    sleep(&swap.busy[slot], &swap.busylock);
+  release(&swap.busylock);
+  swaprw(slot, mem, 0);
+}
+
+// Take another reference to slot.
+void
+swapdup(uint slot)
+{
+  acquire(&swap.lock);
+  if(slot >= swap.nslot || swap.ref[slot] == 0 || swap.ref[slot] == 255)
+    panic("swapdup");
+  swap.ref[slot]++;
+  release(&swap.lock);
+}
+
+// Drop a reference to slot.
+void
+swapfree(uint slot)
+{
+  acquire(&swap.lock);
+  if(slot >= swap.nslot || swap.ref[slot] == 0)
+    panic("swapfree");
+  if(--swap.ref[slot] == 0)
+    swap.nused--;
+  release(&swap.lock);
+}
+
+// Fill in the swap part of m.
+void
+swapstat(struct meminfo *m)
+{
+  acquire(&swap.lock);
+  m->swaptotal = swap.nslot;
+  m->swapused = swap.nused;
+  m->swapout = swap.nout;
+  m->swapin = swap.nin;
+  release(&swap.lock);
+}
+
+// Print swap usage.  Runs when user types ^P on console.
+void
+swapdump(void)
+{
+  if(swap.nslot == 0)
+    return;
+  cprintf("swap: %d/%d pages used, %d out, %d in\n",
+          swap.nused, swap.nslot, swap.nout, swap.nin);
+}
@@ -20,7 +20,7 @@ fetchint(uint addr, int *ip)
 {
   struct proc *curproc = myproc();
 
-  if(addr >= curproc->sz || addr+4 > curproc->sz)
+  if(touchuvm(curproc, addr, 4, 0) < 0)
     return -1;
   *ip = *(int*)(addr);
   return 0;
@@ -35,11 +35,13 @@ fetchstr(uint addr, char **pp)
   char *s, *ep;
   struct proc *curproc = myproc();
 
-  if(addr >= curproc->sz)
+  if(addr >= KERNBASE)
     return -1;
   *pp = (char*)addr;
-  ep = (char*)curproc->sz;
+  ep = (char*)KERNBASE;
   for(s = *pp; s < ep; s++){
+    if((s == *pp || (uint)s % PGSIZE == 0) && touchuvm(curproc, (uint)s, 1, 0) < 0)
+      return -1;
     if(*s == 0)
       return s - *pp;
   }
@@ -60,11 +62,25 @@ int
 argptr(int n, char **pp, int size)
 {
   int i;
-  struct proc *curproc = myproc();
 
   if(argint(n, &i) < 0)
     return -1;
-  if(size < 0 || (uint)i >= curproc->sz || (uint)i+size > curproc->sz)
+  if(size < 0 || touchuvm(myproc(), i, size, 0) < 0)
+    return -1;
+  *pp = (char*)i;
+  return 0;
+}
+
+// Like argptr, for a block the kernel is going to write:
+// also check that the process may write it.
+int
+argwptr(int n, char **pp, int size)
+{
+  int i;
+
+  if(argint(n, &i) < 0)
+    return -1;
+  if(size < 0 || touchuvm(myproc(), i, size, 1) < 0)
     return -1;
   *pp = (char*)i;
   return 0;
@@ -72,8 +88,9 @@ argptr(int n, char **pp, int size)
 
 // Fetch the nth word-sized system call argument as a string pointer.
 // Check that the pointer is valid and the string is nul-terminated.
-// (There is no shared writable memory, so the string can't change
-// between this check and being used by the kernel.)
+// (A string in a MAP_SHARED mapping can change between this check
+// and being used by the kernel; users of the string must not depend
+// on the returned length.)
 int
 argstr(int n, char **pp)
 {
@@ -125,6 +142,16 @@ extern int sys_getprocs(void);
 extern int sys_setpriority(void);
 extern int sys_getpriority(void);
 #endif  //CS333_P4
+extern int sys_mmap(void);
+extern int sys_munmap(void);
+extern int sys_shmget(void);
+extern int sys_shmat(void);
+extern int sys_shmdt(void);
+extern int sys_shmrm(void);
+extern int sys_meminfo(void);
+extern int sys_spawn(void);
+extern int sys_sync(void);
+extern int sys_fsync(void);
 
 static int (*syscalls[])(void) = {
 [SYS_fork]    sys_fork,
@@ -164,8 +191,18 @@ static int (*syscalls[])(void) = {
 #endif	//CS333_P2
 #ifdef CS333_P4
 [SYS_setpriority] sys_setpriority,
-[SYS_getpriority] sys_getpriority
+[SYS_getpriority] sys_getpriority,
 #endif  //CS333_P4
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
+[SYS_shmget]  sys_shmget,
+[SYS_shmat]   sys_shmat,
+[SYS_shmdt]   sys_shmdt,
+[SYS_shmrm]   sys_shmrm,
+[SYS_meminfo] sys_meminfo,
+[SYS_spawn]   sys_spawn,
+[SYS_sync]    sys_sync,
+[SYS_fsync]   sys_fsync,
 };
 
 #ifdef PRINT_SYSCALLS
@@ -207,8 +244,18 @@ static char *syscallnames[] = {
 #endif //CS333_P2
 #ifdef CS333_P4
   [SYS_setpriority] "setpriority",
-  [SYS_getpriority] "getpriority"
+  [SYS_getpriority] "getpriority",
 #endif //CS333_P4
+  [SYS_mmap]    "mmap",
+  [SYS_munmap]  "munmap",
+  [SYS_shmget]  "shmget",
+  [SYS_shmat]   "shmat",
+  [SYS_shmdt]   "shmdt",
+  [SYS_shmrm]   "shmrm",
+  [SYS_meminfo] "meminfo",
+  [SYS_spawn]   "spawn",
+  [SYS_sync]    "sync",
+  [SYS_fsync]   "fsync",
 };
 #endif // PRINT_SYSCALLS
 
@@ -229,4 +276,6 @@ syscall(void)
             curproc->pid, curproc->name, num);
     curproc->tf->eax = -1;
   }
+  // Done with any user memory it touched; see touchuvm().
+  curproc->vmbusy = 0;
 }
@@ -31,3 +31,13 @@
 #define SYS_getprocs  SYS_setgid+1
 #define SYS_setpriority SYS_getprocs+1
 #define SYS_getpriority SYS_setpriority+1
+#define SYS_mmap    SYS_getpriority+1
+#define SYS_munmap  SYS_mmap+1
+#define SYS_shmget  SYS_munmap+1
+#define SYS_shmat   SYS_shmget+1
+#define SYS_shmdt   SYS_shmat+1
+#define SYS_shmrm   SYS_shmdt+1
+#define SYS_meminfo SYS_shmrm+1
+#define SYS_spawn   SYS_meminfo+1
+#define SYS_sync    SYS_spawn+1
+#define SYS_fsync   SYS_sync+1
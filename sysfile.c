@@ -15,6 +15,7 @@
 #include "sleeplock.h"
 #include "file.h"
 #include "fcntl.h"
+#include "mman.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -73,7 +74,7 @@ sys_read(void)
   int n;
   char *p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argwptr(1, &p, n) < 0)
     return -1;
   return fileread(f, p, n);
 }
@@ -109,11 +110,32 @@ sys_fstat(void)
   struct file *f;
   struct stat *st;
 
-  if(argfd(0, 0, &f) < 0 || argptr(1, (void*)&st, sizeof(*st)) < 0)
+  if(argfd(0, 0, &f) < 0 || argwptr(1, (void*)&st, sizeof(*st)) < 0)
     return -1;
   return filestat(f, st);
 }
 
+// Make all finished file system changes durable.
+int
+sys_sync(void)
+{
+  logsync();
+  return 0;
+}
+
+// Make the changes to fd's file durable.  They are in the
+// log with everyone else's, so this is sync().
+int
+sys_fsync(void)
+{
+  struct file *f;
+
+  if(argfd(0, 0, &f) < 0)
+    return -1;
+  logsync();
+  return 0;
+}
+
 // Create the path new as a link to the same inode as old.
 int
 sys_link(void)
@@ -124,7 +146,7 @@ sys_link(void)
   if(argstr(0, &old) < 0 || argstr(1, &new) < 0)
     return -1;
 
-  begin_op();
+  begin_op(OP_LINK);
   if((ip = namei(old)) == 0){
     end_op();
     return -1;
@@ -192,7 +214,7 @@ sys_unlink(void)
   if(argstr(0, &path) < 0)
     return -1;
 
-  begin_op();
+  begin_op(OP_UNLINK);
   if((dp = nameiparent(path, name)) == 0){
     end_op();
     return -1;
@@ -294,7 +316,7 @@ sys_open(void)
   if(argstr(0, &path) < 0 || argint(1, &omode) < 0)
     return -1;
 
-  begin_op();
+  begin_op((omode & O_CREATE) ? OP_CREATE : OP_IPUT);
 
   if(omode & O_CREATE){
     ip = create(path, T_FILE, 0, 0);
@@ -328,6 +350,8 @@ sys_open(void)
   f->type = FD_INODE;
   f->ip = ip;
   f->off = 0;
+  f->raoff = 0;
+  f->rawin = 0;
   f->readable = !(omode & O_WRONLY);
   f->writable = (omode & O_WRONLY) || (omode & O_RDWR);
   return fd;
@@ -339,7 +363,7 @@ sys_mkdir(void)
   char *path;
   struct inode *ip;
 
-  begin_op();
+  begin_op(OP_CREATE);
   if(argstr(0, &path) < 0 || (ip = create(path, T_DIR, 0, 0)) == 0){
     end_op();
     return -1;
@@ -356,7 +380,7 @@ sys_mknod(void)
   char *path;
   int major, minor;
 
-  begin_op();
+  begin_op(OP_CREATE);
   if((argstr(0, &path)) < 0 ||
      argint(1, &major) < 0 ||
      argint(2, &minor) < 0 ||
@@ -376,7 +400,7 @@ sys_chdir(void)
   struct inode *ip;
   struct proc *curproc = myproc();
 
-  begin_op();
+  begin_op(OP_IPUT);
   if(argstr(0, &path) < 0 || (ip = namei(path)) == 0){
     end_op();
     return -1;
@@ -394,19 +418,17 @@ sys_chdir(void)
   return 0;
 }
 
-int
-sys_exec(void)
+// Fetch the argument vector at user address uargv into argv,
+// which has room for MAXARG entries.
+static int
+fetchargv(uint uargv, char **argv)
 {
-  char *path, *argv[MAXARG];
   int i;
-  uint uargv, uarg;
+  uint uarg;
 
-  if(argstr(0, &path) < 0 || argint(1, (int*)&uargv) < 0){
-    return -1;
-  }
-  memset(argv, 0, sizeof(argv));
+  memset(argv, 0, MAXARG*sizeof(argv[0]));
   for(i=0;; i++){
-    if(i >= NELEM(argv))
+    if(i >= MAXARG)
       return -1;
     if(fetchint(uargv+4*i, (int*)&uarg) < 0)
       return -1;
@@ -417,9 +439,49 @@ sys_exec(void)
     if(fetchstr(uarg, &argv[i]) < 0)
       return -1;
   }
+  return 0;
+}
+
+int
+sys_exec(void)
+{
+  char *path, *argv[MAXARG];
+  uint uargv;
+
+  if(argstr(0, &path) < 0 || argint(1, (int*)&uargv) < 0){
+    return -1;
+  }
+  if(fetchargv(uargv, argv) < 0)
+    return -1;
   return exec(path, argv);
 }
 
+// spawn(path, argv, fds): fds is an array of three file
+// descriptors to become the child's 0, 1 and 2, or 0 to pass
+// on the caller's own.
+int
+sys_spawn(void)
+{
+  char *path, *argv[MAXARG];
+  int i, *ufds, fds[3];
+  uint uargv;
+
+  if(argstr(0, &path) < 0 || argint(1, (int*)&uargv) < 0 ||
+     argint(2, (int*)&ufds) < 0)
+    return -1;
+  if(ufds == 0){
+    for(i = 0; i < 3; i++)
+      fds[i] = myproc()->ofile[i] ? i : -1;
+  } else {
+    if(argptr(2, (void*)&ufds, sizeof(fds)) < 0)
+      return -1;
+    memmove(fds, ufds, sizeof(fds));
+  }
+  if(fetchargv(uargv, argv) < 0)
+    return -1;
+  return spawn(path, argv, fds);
+}
+
 int
 sys_pipe(void)
 {
@@ -427,7 +489,7 @@ sys_pipe(void)
   struct file *rf, *wf;
   int fd0, fd1;
 
-  if(argptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0)
+  if(argwptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0)
     return -1;
   if(pipealloc(&rf, &wf) < 0)
     return -1;
@@ -443,3 +505,36 @@ sys_pipe(void)
   fd[1] = fd1;
   return 0;
 }
+
+int
+sys_mmap(void)
+{
+  struct file *f;
+  struct inode *ip;
+  int addr, len, prot, flags, off;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0 || argint(2, &prot) < 0 ||
+     argint(3, &flags) < 0 || argint(5, &off) < 0)
+    return -1;
+  if(len <= 0 || off < 0)
+    return -1;
+  ip = 0;
+  if(!(flags & MAP_ANONYMOUS)){
+    if(argfd(4, 0, &f) < 0 || f->type != FD_INODE || !f->readable)
+      return -1;
+    if((flags & MAP_SHARED) && (prot & PROT_WRITE) && !f->writable)
+      return -1;
+    ip = f->ip;
+  }
+  return vmamap(myproc(), addr, len, prot, flags, ip, off);
+}
+
+int
+sys_munmap(void)
+{
+  int addr, len;
+
+  if(argint(0, &addr) < 0 || argint(1, &len) < 0 || len <= 0)
+    return -1;
+  return vmaunmap(myproc(), addr, len);
+}
@@ -2,6 +2,7 @@
 #include "x86.h"
 #include "defs.h"
 #include "date.h"
+#include "meminfo.h"
 #include "param.h"
 #include "memlayout.h"
 #include "mmu.h"
@@ -96,6 +97,7 @@ sys_uptime(void)
 int
 sys_halt(void)
 {
+  logsync();      // don't lose unsynced changes
   do_shutdown();  // never returns
   return 0;
 }
@@ -108,7 +110,7 @@ sys_date(void)
 {
     struct rtcdate *d;
 
-    if(argptr(0 , (void*)&d , sizeof(struct rtcdate)) <0)
+    if(argwptr(0 , (void*)&d , sizeof(struct rtcdate)) <0)
         return -1;
 
     cmostime(d);
@@ -175,7 +177,7 @@ sys_getprocs(void)
   struct uproc* table;
   if(argint(0 , &max) < 0)
     return -1;
-  if((argptr(1 , (void*)&table , sizeof(struct uproc)*max)) <0)
+  if((argwptr(1 , (void*)&table , sizeof(struct uproc)*max)) <0)
     return -1;
   return getstheprocs( max , table);
 }
@@ -204,3 +206,66 @@ sys_getpriority(void)
   return getpriority(pid);
 }
 #endif  //CS333_P4
+
+int
+sys_shmget(void)
+{
+  int key, size;
+
+  if(argint(0, &key) < 0 || argint(1, &size) < 0 || size <= 0)
+    return -1;
+  return shmget(key, size);
+}
+
+int
+sys_shmat(void)
+{
+  int id, addr;
+  uint size;
+  struct shm *s;
+
+  if(argint(0, &id) < 0)
+    return -1;
+  if((s = shmlookup(id, &size)) == 0)
+    return -1;
+  if((addr = vmashm(myproc(), s, size)) < 0)
+    shmput(s);
+  return addr;
+}
+
+int
+sys_shmdt(void)
+{
+  int addr;
+
+  if(argint(0, &addr) < 0)
+    return -1;
+  return vmashmdt(myproc(), addr);
+}
+
+int
+sys_shmrm(void)
+{
+  int id;
+
+  if(argint(0, &id) < 0)
+    return -1;
+  return shmrm(id);
+}
+
+int
+sys_meminfo(void)
+{
+  struct meminfo *m;
+
+  if(argwptr(0, (void*)&m, sizeof(*m)) < 0)
+    return -1;
+  kmemstat(m);
+  procmemstat(m);
+  pcstat(m);
+  bstat(m);
+  shmstat(m);
+  vmstat(m);
+  swapstat(m);
+  return 0;
+}
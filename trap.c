@@ -91,8 +91,24 @@ trap(struct trapframe *tf)
     lapiceoi();
     break;
 
+  case T_PGFLT:
+    // Demand paging and copy-on-write.  A fault on an absent
+    // page taken in the kernel can only be serviced if no spin
+    // locks are held, since reading the page may sleep.
+    if(myproc() && rcr2() < KERNBASE &&
+       ((tf->cs&3) == DPL_USER || (tf->err & FEC_PR) || mycpu()->ncli == 0) &&
+       pagefault(myproc(), rcr2(), tf->err & FEC_WR) == 0)
+      break;
+    // Not a demand-paged address: fall through.
+
   //PAGEBREAK: 13
   default:
+    if(tf->trapno == T_IRQ0 + ideirq){
+      // A disk whose interrupt line is set by PCI.
+      ideintr();
+      lapiceoi();
+      break;
+    }
     if(myproc() == 0 || (tf->cs&3) == 0){
       // In kernel, it must be our mistake.
       cprintf("unexpected trap %d from cpu %d eip %x (cr2=0x%x)\n",
@@ -22,6 +22,11 @@
 #define T_MCHK          18      // machine check
 #define T_SIMDERR       19      // SIMD floating point error
 
+// Page fault error code bits (tf->err for T_PGFLT)
+#define FEC_PR          0x1     // Page present (protection violation)
+#define FEC_WR          0x2     // Fault caused by a write
+#define FEC_U           0x4     // Fault occurred in user mode
+
 // These are arbitrarily chosen, but with care not to overlap
 // processor defined exceptions or interrupt vectors.
 #define T_SYSCALL       64      // system call
@@ -14,6 +14,12 @@ struct uproc {
   uint CPU_total_ticks;
   char state[STRMAX];
   uint size;
+  uint rss;            // resident pages
+  uint swapped;        // pages paged out to swap
+  uint ptpages;        // page-table pages
+  uint minflt;         // page faults served from memory
+  uint majflt;         // page faults that read from disk
+  uint cowflt;         // copy-on-write breaks
   char name[STRMAX];
 };
 #endif
@@ -3,6 +3,7 @@
 struct stat;
 struct rtcdate;
 struct uproc;
+struct meminfo;
 
 // system calls
 int fork(void);
@@ -27,6 +28,16 @@ char* sbrk(int);
 int sleep(int);
 int uptime(void);
 int halt(void);
+void* mmap(void*, uint, int, int, int, int);
+int munmap(void*, uint);
+int shmget(int, uint);
+void* shmat(int);
+int shmdt(void*);
+int shmrm(int);
+int meminfo(struct meminfo*);
+int spawn(char*, char**, int*);
+int sync(void);
+int fsync(int);
 
 // ulib.c
 int stat(char*, struct stat*);
@@ -7,6 +7,8 @@
 #include "syscall.h"
 #include "traps.h"
 #include "memlayout.h"
+#include "mman.h"
+#include "meminfo.h"
 
 char buf[8192];
 char name[3];
@@ -1589,6 +1591,373 @@ validatetest(void)
   printf(stdout, "validate ok\n");
 }
 
+// mmap of a file, private and shared, and of shared anonymous
+// memory across fork.
+void
+mmaptest(void)
+{
+  int fd, i, pid, n, fds[2];
+  char *p, c;
+
+  printf(stdout, "mmap test\n");
+  n = 2*4096 + 100;
+  fd = open("mmapf", O_CREATE|O_RDWR);
+  for(i = 0; i < 8192; i++)
+    buf[i] = 'a' + i % 26;
+  if(fd < 0 || write(fd, buf, 8192) != 8192){
+    printf(stdout, "mmap: create failed\n");
+    exit();
+  }
+  for(i = 0; i < 100; i++)
+    buf[i] = 'a' + (8192 + i) % 26;
+  if(write(fd, buf, 100) != 100){
+    printf(stdout, "mmap: create failed\n");
+    exit();
+  }
+
+  p = mmap(0, n, PROT_READ|PROT_WRITE, MAP_PRIVATE, fd, 0);
+  if(p == MAP_FAILED){
+    printf(stdout, "mmap: private map failed\n");
+    exit();
+  }
+  for(i = 0; i < n; i++){
+    if(p[i] != 'a' + i % 26){
+      printf(stdout, "mmap: wrong content at %d\n", i);
+      exit();
+    }
+  }
+  if(p[n] != 0 || p[3*4096-1] != 0){
+    printf(stdout, "mmap: tail not zero\n");
+    exit();
+  }
+  p[0] = 'Z';
+  if(munmap(p, n) < 0){
+    printf(stdout, "mmap: munmap failed\n");
+    exit();
+  }
+
+  p = mmap(0, n, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == MAP_FAILED || p[0] != 'a'){
+    printf(stdout, "mmap: private write reached the file\n");
+    exit();
+  }
+  p[1] = 'Y';
+  p[4096] = 'X';
+  munmap(p, n);
+  close(fd);
+  fd = open("mmapf", O_RDONLY);
+  if(read(fd, buf, 4097) != 4097 || buf[1] != 'Y' || buf[4096] != 'X'){
+    printf(stdout, "mmap: shared write lost\n");
+    exit();
+  }
+  close(fd);
+  unlink("mmapf");
+
+  p = mmap(0, 4096, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED){
+    printf(stdout, "mmap: anonymous map failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid == 0){
+    p[10] = 42;
+    exit();
+  }
+  wait();
+  if(p[10] != 42){
+    printf(stdout, "mmap: shared page not shared\n");
+    exit();
+  }
+  munmap(p, 4096);
+
+  p = mmap(0, 4096, PROT_READ|PROT_WRITE,
+           MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+  if(p == MAP_FAILED || (uint)p % (4*1024*1024) != 0){
+    printf(stdout, "mmap: large page map failed\n");
+    exit();
+  }
+  p[4*1024*1024-1] = 7;
+  if(pipe(fds) < 0){
+    printf(stdout, "mmap: pipe failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid == 0){
+    // Tell the parent what the copy holds, and write to it.
+    write(fds[1], &p[4*1024*1024-1], 1);
+    p[0] = 9;
+    exit();
+  }
+  wait();
+  c = 0;
+  read(fds[0], &c, 1);
+  close(fds[0]);
+  close(fds[1]);
+  if(c != 7 || p[0] != 0){
+    printf(stdout, "mmap: large page not copied\n");
+    exit();
+  }
+  if(munmap(p, 4096) == 0 || munmap(p, 4*1024*1024) < 0){
+    printf(stdout, "mmap: large page unmap wrong\n");
+    exit();
+  }
+  printf(stdout, "mmap ok\n");
+}
+
+// MAP_SHARED mappings of a file stay coherent when one of them
+// is written back: one process maps the file and another maps
+// it and unmaps it, which writes its page back.  A third then
+// maps the file, and all three must see each other's stores.
+// A write() must reach the mappings too, and not be undone
+// when a mapping is written back.
+void
+mmapsharetest(void)
+{
+  int fd, fd2, i, pid, tochild[2], toparent[2];
+  char *p, *q, c;
+
+  printf(stdout, "mmap share test\n");
+  fd = open("mmapf", O_CREATE|O_RDWR);
+  memset(buf, 'a', 4096);
+  if(fd < 0 || write(fd, buf, 4096) != 4096){
+    printf(stdout, "mmap share: create failed\n");
+    exit();
+  }
+  p = mmap(0, 4096, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if(p == MAP_FAILED){
+    printf(stdout, "mmap share: map failed\n");
+    exit();
+  }
+  p[0] = 'P';
+
+  pid = fork();
+  if(pid == 0){
+    q = mmap(0, 4096, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if(q == MAP_FAILED || q[0] != 'P'){
+      printf(stdout, "mmap share: first child doesn't see parent\n");
+      exit();
+    }
+    q[1] = 'A';
+    munmap(q, 4096);
+    exit();
+  }
+  wait();
+  if(p[1] != 'A'){
+    printf(stdout, "mmap share: parent doesn't see first child\n");
+    exit();
+  }
+
+  if(pipe(tochild) < 0 || pipe(toparent) < 0){
+    printf(stdout, "mmap share: pipe failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid == 0){
+    q = mmap(0, 4096, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+    if(q == MAP_FAILED || q[0] != 'P' || q[1] != 'A'){
+      printf(stdout, "mmap share: second child doesn't see the others\n");
+      exit();
+    }
+    q[2] = 'B';
+    write(toparent[1], "x", 1);
+    read(tochild[0], &c, 1);
+    if(q[3] != 'Q')
+      printf(stdout, "mmap share: second child doesn't see parent\n");
+    exit();
+  }
+  read(toparent[0], &c, 1);
+  if(p[2] != 'B'){
+    printf(stdout, "mmap share: parent doesn't see second child\n");
+    exit();
+  }
+  p[3] = 'Q';
+  write(tochild[1], "x", 1);
+  wait();
+  for(i = 0; i < 2; i++){
+    close(tochild[i]);
+    close(toparent[i]);
+  }
+
+  fd2 = open("mmapf", O_RDWR);
+  if(fd2 < 0 || write(fd2, "W", 1) != 1 || p[0] != 'W'){
+    printf(stdout, "mmap share: mapping doesn't see write()\n");
+    exit();
+  }
+  close(fd2);
+  munmap(p, 4096);
+  close(fd);
+  fd = open("mmapf", O_RDONLY);
+  if(read(fd, buf, 4) != 4 || buf[0] != 'W' || buf[1] != 'A' ||
+     buf[2] != 'B' || buf[3] != 'Q'){
+    printf(stdout, "mmap share: stores lost\n");
+    exit();
+  }
+  close(fd);
+  unlink("mmapf");
+  printf(stdout, "mmap share ok\n");
+}
+
+// shared memory segments: attach in two processes, and
+// inherit an attachment across fork.
+void
+shmtest(void)
+{
+  int id, pid;
+  char *p, *q;
+
+  printf(stdout, "shm test\n");
+  if((id = shmget(1234, 3*4096)) < 0 || (p = shmat(id)) == (char*)-1){
+    printf(stdout, "shm: get/attach failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid == 0){
+    p[0] = 'i';
+    if((q = shmat(shmget(1234, 4096))) == (char*)-1){
+      printf(stdout, "shm: child attach failed\n");
+      exit();
+    }
+    q[2*4096] = 'j';
+    shmdt(q);
+    exit();
+  }
+  wait();
+  if(p[0] != 'i' || p[2*4096] != 'j'){
+    printf(stdout, "shm: writes not shared\n");
+    exit();
+  }
+  if(shmrm(id) < 0 || shmdt(p) < 0 || shmat(id) != (char*)-1){
+    printf(stdout, "shm: remove failed\n");
+    exit();
+  }
+  printf(stdout, "shm ok\n");
+}
+
+void
+meminfotest(void)
+{
+  struct meminfo a, b;
+  char *p;
+
+  printf(stdout, "meminfo test\n");
+  if(meminfo(&a) < 0 || a.free > a.total || a.zero > a.free ||
+     a.kstack == 0 || a.pgtab == 0){
+    printf(stdout, "meminfo: bad counts\n");
+    exit();
+  }
+  p = mmap(0, 2*4096, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+  if(p == MAP_FAILED){
+    printf(stdout, "meminfo: mmap failed\n");
+    exit();
+  }
+  p[0] = 1;
+  p[4096] = 1;
+  munmap(p, 2*4096);
+  if(meminfo(&b) < 0 || b.minflt < a.minflt + 2){
+    printf(stdout, "meminfo: faults not counted\n");
+    exit();
+  }
+  printf(stdout, "meminfo ok\n");
+}
+
+// spawn() runs a program with the given descriptors,
+// and fails cleanly for a program that doesn't exist.
+void
+spawntest(void)
+{
+  char *argv[3];
+  int p[2], fds[3], pid, n;
+  char b[16];
+
+  printf(stdout, "spawn test\n");
+  if(pipe(p) != 0){
+    printf(stdout, "spawn: pipe failed\n");
+    exit();
+  }
+  argv[0] = "echo";
+  argv[1] = "spawned";
+  argv[2] = 0;
+  fds[0] = 0;
+  fds[1] = p[1];
+  fds[2] = 2;
+  if((pid = spawn("echo", argv, fds)) < 0){
+    printf(stdout, "spawn: spawn echo failed\n");
+    exit();
+  }
+  close(p[1]);
+  n = read(p[0], b, sizeof(b)-1);
+  close(p[0]);
+  b[n < 0 ? 0 : n] = 0;
+  if(strcmp(b, "spawned\n") != 0){
+    printf(stdout, "spawn: wrong output\n");
+    exit();
+  }
+  if(wait() != pid){
+    printf(stdout, "spawn: wait wrong pid\n");
+    exit();
+  }
+  argv[0] = "nosuchprogram";
+  argv[1] = 0;
+  if(spawn("nosuchprogram", argv, 0) >= 0){
+    printf(stdout, "spawn: nosuchprogram succeeded\n");
+    exit();
+  }
+  fds[1] = 100;
+  if(spawn("echo", argv, fds) >= 0){
+    printf(stdout, "spawn: bad fd accepted\n");
+    exit();
+  }
+  printf(stdout, "spawn ok\n");
+}
+
+// fsync() and sync() succeed, and the data is there afterwards.
+void
+synctest(void)
+{
+  int fd;
+  char b[8];
+
+  printf(stdout, "sync test\n");
+  fd = open("syncfile", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(stdout, "sync: create failed\n");
+    exit();
+  }
+  if(write(fd, "synced", 7) != 7){
+    printf(stdout, "sync: write failed\n");
+    exit();
+  }
+  if(fsync(fd) != 0){
+    printf(stdout, "sync: fsync failed\n");
+    exit();
+  }
+  close(fd);
+  if(fsync(fd) >= 0){
+    printf(stdout, "sync: fsync of closed fd succeeded\n");
+    exit();
+  }
+  if(unlink("syncfile") != 0 || sync() != 0){
+    printf(stdout, "sync: sync failed\n");
+    exit();
+  }
+  if(open("syncfile", 0) >= 0){
+    printf(stdout, "sync: unlinked file still there\n");
+    exit();
+  }
+  fd = open("syncfile", O_CREATE|O_RDWR);
+  write(fd, "synced", 7);
+  sync();
+  close(fd);
+  fd = open("syncfile", 0);
+  if(fd < 0 || read(fd, b, sizeof(b)) != 7 || strcmp(b, "synced") != 0){
+    printf(stdout, "sync: wrong data\n");
+    exit();
+  }
+  close(fd);
+  unlink("syncfile");
+  printf(stdout, "sync ok\n");
+}
+
 // does unintialized data start out zero?
 char uninit[10000];
 void
@@ -1769,6 +2138,12 @@ main(int argc, char *argv[])
   bsstest();
   sbrktest();
   validatetest();
+  mmaptest();
+  mmapsharetest();
+  shmtest();
+  meminfotest();
+  spawntest();
+  synctest();
 
   opentest();
   writetest();
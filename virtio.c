@@ -0,0 +1,280 @@
+// Virtio block device driver, for the legacy PCI interface.
+// Built in place of ide.c with DISK=virtio; it serves disk 1,
+// which holds the file system and swap.  Disk 0, the boot
+// disk, stays on IDE, and only the boot loader reads it.
+//
+// The driver and the device share a virtqueue: a table of
+// descriptors, each naming a piece of memory; a ring in which
+// the driver makes requests available; and a ring in which the
+// device hands them back when done.  A request is a chain of
+// three descriptors: a header that says what to do and where,
+// the buffer's data, and a status byte the device fills in.
+// The device works on all the requests it has at once, and
+// interrupts as they finish.  A request that can't get
+// descriptors waits on a list until others finish.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "memlayout.h"
+#include "mmu.h"
+#include "proc.h"
+#include "x86.h"
+#include "traps.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "buf.h"
+#include "pci.h"
+#include "virtio.h"
+
+#define SECTOR_SIZE   512
+#define NDESC         256   // largest queue we handle
+
+// The queue itself: the descriptor table and available ring,
+// then the used ring on the next page.  The device reads and
+// writes it directly, so it must be physically contiguous.
+static uchar vring[PGROUNDUP(NDESC*sizeof(struct vring_desc) + 6 + 2*NDESC) +
+                   PGROUNDUP(6 + NDESC*sizeof(struct vring_used_elem))]
+  __attribute__((aligned(VRING_ALIGN)));
+
+// You must hold vdisk.lock while manipulating the queue.
+static struct {
+  struct spinlock lock;
+  uint base;                    // I/O base of the device registers
+  uint size;                    // in sectors
+  int n;                        // descriptors in the queue
+  struct vring_desc *desc;
+  struct vring_avail *avail;
+  volatile struct vring_used *used;
+  ushort usedidx;               // next used entry to look at
+  char free[NDESC];             // is a descriptor free?
+  int nfree;
+  struct {
+    struct virtio_blk_req hdr;
+    uchar status;
+    struct buf *b;
+  } req[NDESC];                 // by first descriptor of a request
+  struct buf *waiting;          // requests waiting for descriptors
+} vdisk;
+
+// Interrupt line of the device, for trap().
+int ideirq;
+
+void
+ideinit(void)
+{
+  struct pcidev d;
+  uint n;
+
+  initlock(&vdisk.lock, "virtio");
+
+  if(pcifind(VIRTIO_VENDOR, VIRTIO_BLK_DEVICE, PCI_ANY, PCI_ANY, &d) < 0 ||
+     !(d.bar[0] & PCI_BAR_IO)){
+    cprintf("virtio: no disk\n");
+    return;
+  }
+  pcienable(&d);
+  vdisk.base = PCI_BAR_IOADDR(d.bar[0]);
+
+  // Reset the device and tell it we know how to drive it.
+  // We need none of its optional features.
+  outb(vdisk.base+VIRTIO_STATUS, 0);
+  outb(vdisk.base+VIRTIO_STATUS, VIRTIO_ACK);
+  outb(vdisk.base+VIRTIO_STATUS, VIRTIO_ACK|VIRTIO_DRIVER);
+  outl(vdisk.base+VIRTIO_GUEST_FEATURES, 0);
+
+  // Set up queue 0, the only one a block device has.  The
+  // device chooses its size.
+  outw(vdisk.base+VIRTIO_QUEUE_SEL, 0);
+  n = inw(vdisk.base+VIRTIO_QUEUE_SIZE);
+  if(n == 0 || n > NDESC)
+    panic("virtio: queue size");
+  vdisk.n = n;
+  vdisk.desc = (struct vring_desc*)vring;
+  vdisk.avail = (struct vring_avail*)(vring + n*sizeof(struct vring_desc));
+  vdisk.used = (struct vring_used*)
+    (vring + PGROUNDUP(n*sizeof(struct vring_desc) + 6 + 2*n));
+  vdisk.nfree = n;
+  memset(vdisk.free, 1, n);
+  outl(vdisk.base+VIRTIO_QUEUE_PFN, V2P(vring) >> PGSHIFT);
+
+  vdisk.size = inl(vdisk.base+VIRTIO_BLK_CAPACITY);
+  if(inl(vdisk.base+VIRTIO_BLK_CAPACITY+4) != 0)
+    vdisk.size = 0xffffffff;
+
+  ideirq = d.irq;
+  ioapicenable(ideirq, ncpu - 1);
+  outb(vdisk.base+VIRTIO_STATUS, VIRTIO_ACK|VIRTIO_DRIVER|VIRTIO_DRIVER_OK);
+}
+
+// Number of blocks on disk dev.
+uint
+idesize(uint dev)
+{
+  if(dev != 1)
+    return 0;
+  return vdisk.size / (BSIZE/SECTOR_SIZE);
+}
+
+// Fill in descriptor i.
+static void
+setdesc(int i, void *p, uint len, ushort flags, ushort next)
+{
+  vdisk.desc[i].addr = V2P(p);
+  vdisk.desc[i].addrhi = 0;
+  vdisk.desc[i].len = len;
+  vdisk.desc[i].flags = flags;
+  vdisk.desc[i].next = next;
+}
+
+// Make the request for b available to the device.
+// Returns -1 if there aren't enough free descriptors.
+// Caller must hold vdisk.lock.
+static int
+vstart(struct buf *b)
+{
+  int d[3], i, j, write;
+
+  if(vdisk.nfree < 3)
+    return -1;
+  for(i = j = 0; j < 3; i++){
+    if(vdisk.free[i]){
+      vdisk.free[i] = 0;
+      d[j++] = i;
+    }
+  }
+  vdisk.nfree -= 3;
+
+  write = (b->flags & B_DIRTY) != 0;
+  vdisk.req[d[0]].hdr.type = write ? VIRTIO_BLK_T_OUT : VIRTIO_BLK_T_IN;
+  vdisk.req[d[0]].hdr.reserved = 0;
+  vdisk.req[d[0]].hdr.sector = b->blockno * (BSIZE/SECTOR_SIZE);
+  vdisk.req[d[0]].hdr.sectorhi = 0;
+  vdisk.req[d[0]].status = 0xff;
+  vdisk.req[d[0]].b = b;
+
+  setdesc(d[0], &vdisk.req[d[0]].hdr, sizeof(struct virtio_blk_req),
+          VRING_DESC_NEXT, d[1]);
+  setdesc(d[1], b->data, BSIZE,
+          VRING_DESC_NEXT | (write ? 0 : VRING_DESC_WRITE), d[2]);
+  setdesc(d[2], &vdisk.req[d[0]].status, 1, VRING_DESC_WRITE, 0);
+
+  // The device must see the descriptors before the ring entry,
+  // and the ring entry before the new index.
+  vdisk.avail->ring[vdisk.avail->idx % vdisk.n] = d[0];
+  __sync_synchronize();
+  vdisk.avail->idx++;
+  __sync_synchronize();
+  outw(vdisk.base+VIRTIO_QUEUE_NOTIFY, 0);
+  return 0;
+}
+
+// Free the chain of descriptors starting at i.
+// Caller must hold vdisk.lock.
+static void
+freechain(int i)
+{
+  for(;;){
+    vdisk.free[i] = 1;
+    vdisk.nfree++;
+    if(!(vdisk.desc[i].flags & VRING_DESC_NEXT))
+      break;
+    i = vdisk.desc[i].next;
+  }
+}
+
+// Interrupt handler.
+void
+ideintr(void)
+{
+  struct buf *b;
+  void (*done)(struct buf*);
+  int id;
+
+  acquire(&vdisk.lock);
+
+  // Reading the ISR acknowledges the interrupt; any request
+  // that finishes after this interrupts again.
+  inb(vdisk.base+VIRTIO_ISR);
+  __sync_synchronize();
+
+  // Wake processes waiting for finished requests, and tell
+  // whoever started them.
+  while(vdisk.usedidx != vdisk.used->idx){
+    __sync_synchronize();
+    id = vdisk.used->ring[vdisk.usedidx % vdisk.n].id;
+    vdisk.usedidx++;
+    if(vdisk.req[id].status != 0)
+      panic("virtio: disk error");
+    b = vdisk.req[id].b;
+    vdisk.req[id].b = 0;
+    freechain(id);
+    b->flags |= B_VALID;
+    b->flags &= ~B_DIRTY;
+    done = b->done;
+    b->done = 0;
+    wakeup(b);
+    if(done)
+      done(b);
+  }
+
+  // Start requests that were waiting for descriptors.
+  while((b = vdisk.waiting) != 0 && vstart(b) == 0)
+    vdisk.waiting = b->qnext;
+
+  release(&vdisk.lock);
+}
+
+//PAGEBREAK!
+// Start syncing buf with disk, and return without waiting.
+// If B_DIRTY is set, write buf to disk, clear B_DIRTY, set B_VALID.
+// Else if B_VALID is not set, read buf from disk, set B_VALID.
+// When the request finishes, ideintr() wakes up idewaitbuf()
+// and calls b->done(b), if set.  b stays locked throughout.
+void
+idesubmit(struct buf *b)
+{
+  struct buf **pp;
+
+  if(!holdingsleep(&b->lock))
+    panic("iderw: buf not locked");
+  if((b->flags & (B_VALID|B_DIRTY)) == B_VALID)
+    panic("iderw: nothing to do");
+  if(b->dev != 1)
+    panic("iderw: request not for disk 1");
+  if(vdisk.n == 0)
+    panic("iderw: virtio disk not present");
+
+  acquire(&vdisk.lock);
+
+  // Requests start in order: b waits if others already are.
+  b->qnext = 0;
+  b->qtime = ticks;
+  if(vdisk.waiting || vstart(b) < 0){
+    for(pp = &vdisk.waiting; *pp; pp = &(*pp)->qnext)
+      ;
+    *pp = b;
+  }
+
+  release(&vdisk.lock);
+}
+
+// Wait for the request for b to finish.
+void
+idewaitbuf(struct buf *b)
+{
+  acquire(&vdisk.lock);
+  while((b->flags & (B_VALID|B_DIRTY)) != B_VALID){
+    sleep(b, &vdisk.lock);
+  }
+  release(&vdisk.lock);
+}
+
+// Sync buf with disk, waiting for it to finish.
+void
+iderw(struct buf *b)
+{
+  idesubmit(b);
+  idewaitbuf(b);
+}
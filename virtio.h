@@ -0,0 +1,67 @@
+// Virtio block device, legacy PCI interface.
+
+#define VIRTIO_VENDOR       0x1af4
+#define VIRTIO_BLK_DEVICE   0x1001   // transitional block device
+
+// Registers, as offsets from the I/O base in BAR 0.
+#define VIRTIO_HOST_FEATURES   0x00
+#define VIRTIO_GUEST_FEATURES  0x04
+#define VIRTIO_QUEUE_PFN       0x08  // physical page number of the queue
+#define VIRTIO_QUEUE_SIZE      0x0c
+#define VIRTIO_QUEUE_SEL       0x0e
+#define VIRTIO_QUEUE_NOTIFY    0x10
+#define VIRTIO_STATUS          0x12
+#define VIRTIO_ISR             0x13  // reading acknowledges the interrupt
+#define VIRTIO_BLK_CAPACITY    0x14  // in sectors; 64 bits
+
+// Device status bits.
+#define VIRTIO_ACK          1
+#define VIRTIO_DRIVER       2
+#define VIRTIO_DRIVER_OK    4
+
+// The used ring starts on the next boundary of this many bytes
+// after the available ring.
+#define VRING_ALIGN         4096
+
+// A descriptor: a piece of memory the device reads or writes.
+struct vring_desc {
+  uint addr;          // physical address; low 32 bits
+  uint addrhi;
+  uint len;
+  ushort flags;
+  ushort next;        // next descriptor, if flags has VRING_DESC_NEXT
+};
+
+#define VRING_DESC_NEXT     1   // chained with the next field
+#define VRING_DESC_WRITE    2   // device writes (vs reads)
+
+// Requests the driver has made available to the device,
+// by first descriptor.
+struct vring_avail {
+  ushort flags;
+  ushort idx;         // where the driver puts the next entry
+  ushort ring[];
+};
+
+struct vring_used_elem {
+  uint id;            // first descriptor of a finished request
+  uint len;
+};
+
+// Requests the device has finished.
+struct vring_used {
+  ushort flags;
+  ushort idx;         // where the device puts the next entry
+  struct vring_used_elem ring[];
+};
+
+// The header at the start of every request.
+struct virtio_blk_req {
+  uint type;
+  uint reserved;
+  uint sector;        // low 32 bits
+  uint sectorhi;
+};
+
+#define VIRTIO_BLK_T_IN     0   // read
+#define VIRTIO_BLK_T_OUT    1   // write
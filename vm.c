@@ -6,6 +6,13 @@
 #include "mmu.h"
 #include "proc.h"
 #include "elf.h"
+#include "spinlock.h"
+#include "sleeplock.h"
+#include "fs.h"
+#include "file.h"
+#include "stat.h"
+#include "mman.h"
+#include "meminfo.h"
 
 extern char data[];  // defined by kernel.ld
 pde_t *kpgdir;  // for use in scheduler()
@@ -32,6 +39,8 @@ seginit(void)
 // Return the address of the PTE in page table pgdir
 // that corresponds to virtual address va.  If alloc!=0,
 // create any required page table pages.
+// If va is mapped by a large page, returns its PDE, which
+// has the same layout as a PTE apart from PTE_PS.
 static pte_t *
 walkpgdir(pde_t *pgdir, const void *va, int alloc)
 {
@@ -39,13 +48,14 @@ walkpgdir(pde_t *pgdir, const void *va, int alloc)
   pte_t *pgtab;
 
   pde = &pgdir[PDX(va)];
+  if(*pde & PTE_PS)
+    return pde;
   if(*pde & PTE_P){
     pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
   } else {
-    if(!alloc || (pgtab = (pte_t*)kalloc()) == 0)
-      return 0;
     // Make sure all those PTE_P bits are zero.
-    memset(pgtab, 0, PGSIZE);
+    if(!alloc || (pgtab = (pte_t*)kzalloc()) == 0)
+      return 0;
     // The permissions here are overly generous, but they can
     // be further restricted by the permissions in the page table
     // entries, if necessary.
@@ -114,33 +124,68 @@ static struct kmap {
  { (void*)DEVSPACE, DEVSPACE,      0,         PTE_W}, // more devices
 };
 
+// Map kmap entry k into pgdir, using large pages for the
+// parts that are LPGSIZE aligned in both address spaces.
+// That covers nearly all of physical memory, so the kernel
+// mappings need only a handful of page table pages.
+static int
+mapkmap(pde_t *pgdir, struct kmap *k)
+{
+  uint va, pa, size, n;
+
+  va = (uint)k->virt;
+  pa = k->phys_start;
+  size = k->phys_end - k->phys_start;
+  while(size > 0){
+    if(va % LPGSIZE == 0 && pa % LPGSIZE == 0 && size >= LPGSIZE){
+      pgdir[PDX(va)] = pa | k->perm | PTE_PS | PTE_P;
+      n = LPGSIZE;
+    } else {
+      n = PGSIZE;
+      if(mappages(pgdir, (void*)va, n, pa, k->perm) < 0)
+        return -1;
+    }
+    va += n;
+    pa += n;
+    size -= n;
+  }
+  return 0;
+}
+
 // Set up kernel part of a page table.
+// The kernel mappings never change after boot, so every page
+// directory shares kpgdir's entries for KERNBASE and above,
+// including its page table pages.  Only the user half is
+// private to a process.
 pde_t*
 setupkvm(void)
 {
   pde_t *pgdir;
-  struct kmap *k;
 
   if((pgdir = (pde_t*)kalloc()) == 0)
     return 0;
-  memset(pgdir, 0, PGSIZE);
-  if (P2V(PHYSTOP) > (void*)DEVSPACE)
-    panic("PHYSTOP too high");
-  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
-    if(mappages(pgdir, k->virt, k->phys_end - k->phys_start,
-                (uint)k->phys_start, k->perm) < 0) {
-      freevm(pgdir);
-      return 0;
-    }
+  memset(pgdir, 0, PDX(KERNBASE)*sizeof(pde_t));
+  memmove(&pgdir[PDX(KERNBASE)], &kpgdir[PDX(KERNBASE)],
+          (NPDENTRIES - PDX(KERNBASE))*sizeof(pde_t));
   return pgdir;
 }
 
 // Allocate one page table for the machine for the kernel address
-// space for scheduler processes.
+// space for scheduler processes.  Its kernel half is the template
+// for every other page table.
 void
 kvmalloc(void)
 {
-  kpgdir = setupkvm();
+  struct kmap *k;
+
+  if((kpgdir = (pde_t*)kalloc()) == 0)
+    panic("kvmalloc");
+  memset(kpgdir, 0, PGSIZE);
+  if (P2V(PHYSTOP) > (void*)DEVSPACE)
+    panic("PHYSTOP too high");
+  for(k = kmap; k < &kmap[NELEM(kmap)]; k++)
+    if(mapkmap(kpgdir, k) < 0)
+      panic("kvmalloc: mapkmap");
   switchkvm();
 }
 
@@ -186,8 +231,7 @@ inituvm(pde_t *pgdir, char *init, uint sz)
 
   if(sz >= PGSIZE)
     panic("inituvm: more than a page");
-  mem = kalloc();
-  memset(mem, 0, PGSIZE);
+  mem = kzalloc();
   mappages(pgdir, 0, PGSIZE, V2P(mem), PTE_W|PTE_U);
   memmove(mem, init, sz);
 }
@@ -231,13 +275,12 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 
   a = PGROUNDUP(oldsz);
   for(; a < newsz; a += PGSIZE){
-    mem = kalloc();
+    mem = ualloc(1);
     if(mem == 0){
       cprintf("allocuvm out of memory\n");
       deallocuvm(pgdir, newsz, oldsz);
       return 0;
     }
-    memset(mem, 0, PGSIZE);
     if(mappages(pgdir, (char*)a, PGSIZE, V2P(mem), PTE_W|PTE_U) < 0){
       cprintf("allocuvm out of memory (2)\n");
       deallocuvm(pgdir, newsz, oldsz);
@@ -248,6 +291,31 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
   return newsz;
 }
 
+// Pages waiting to be freed together, so that tearing down an
+// address space takes kmem.lock once per batch, not per page.
+struct pgbatch {
+  int n;
+  char *v[32];
+};
+
+static void
+pgbatchadd(struct pgbatch *b, char *v)
+{
+  b->v[b->n++] = v;
+  if(b->n == NELEM(b->v)){
+    kfreen(b->v, b->n);
+    b->n = 0;
+  }
+}
+
+static void
+pgbatchflush(struct pgbatch *b)
+{
+  if(b->n > 0)
+    kfreen(b->v, b->n);
+  b->n = 0;
+}
+
 // Deallocate user pages to bring the process size from oldsz to
 // newsz.  oldsz and newsz need not be page-aligned, nor does newsz
 // need to be less than oldsz.  oldsz can be larger than the actual
@@ -255,14 +323,25 @@ allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 int
 deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
 {
+  struct pgbatch b;
   pte_t *pte;
   uint a, pa;
 
   if(newsz >= oldsz)
     return oldsz;
 
+  b.n = 0;
   a = PGROUNDUP(newsz);
   for(; a  < oldsz; a += PGSIZE){
+    if(pgdir[PDX(a)] & PTE_PS){
+      // Large pages are only ever unmapped whole.
+      if(a % LPGSIZE != 0 || a + LPGSIZE > oldsz)
+        panic("deallocuvm: part of a large page");
+      lpfree(P2V(PTE_ADDR(pgdir[PDX(a)])));
+      pgdir[PDX(a)] = 0;
+      a += LPGSIZE - PGSIZE;
+      continue;
+    }
     pte = walkpgdir(pgdir, (char*)a, 0);
     if(!pte)
       a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
@@ -271,30 +350,37 @@ deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
       if(pa == 0)
         panic("kfree");
       char *v = P2V(pa);
-      kfree(v);
+      pgbatchadd(&b, v);
+      *pte = 0;
+    } else if(*pte & PTE_SWAP){
+      swapfree(PTE_ADDR(*pte) >> PTXSHIFT);
       *pte = 0;
     }
   }
+  pgbatchflush(&b);
   return newsz;
 }
 
 // Free a page table and all the physical memory pages
-// in the user part.
+// in the user part.  The kernel part belongs to kpgdir.
 void
 freevm(pde_t *pgdir)
 {
+  struct pgbatch b;
   uint i;
 
   if(pgdir == 0)
     panic("freevm: no pgdir");
   deallocuvm(pgdir, KERNBASE, 0);
-  for(i = 0; i < NPDENTRIES; i++){
-    if(pgdir[i] & PTE_P){
+  b.n = 0;
+  for(i = 0; i < PDX(KERNBASE); i++){
+    if((pgdir[i] & (PTE_P|PTE_PS)) == PTE_P){
       char * v = P2V(PTE_ADDR(pgdir[i]));
-      kfree(v);
+      pgbatchadd(&b, v);
     }
   }
-  kfree((char*)pgdir);
+  pgbatchadd(&b, (char*)pgdir);
+  pgbatchflush(&b);
 }
 
 // Clear PTE_U on a page. Used to create an inaccessible
@@ -310,30 +396,84 @@ clearpteu(pde_t *pgdir, char *uva)
   *pte &= ~PTE_U;
 }
 
+// Copy the large page at va from pgdir s into pgdir d:
+// shared pages are shared, private ones copied.
+static int
+copylarge(pde_t *d, pde_t *s, uint va)
+{
+  pde_t pde;
+  char *mem;
+
+  pde = s[PDX(va)];
+  if(pde & PTE_SHR){
+    lpref(P2V(PTE_ADDR(pde)));
+    d[PDX(va)] = pde & ~PTE_D;
+    return 0;
+  }
+  if((mem = lpalloc()) == 0)
+    return -1;
+  memmove(mem, P2V(PTE_ADDR(pde)), LPGSIZE);
+  d[PDX(va)] = V2P(mem) | PTE_FLAGS(pde);
+  return 0;
+}
+
 // Given a parent process's page table, create a copy
-// of it for a child.
+// of it for a child.  This covers the whole user address
+// space, not just [0, sz), so that mmap() regions are copied.
 pde_t*
-copyuvm(pde_t *pgdir, uint sz)
+copyuvm(pde_t *pgdir)
 {
   pde_t *d;
-  pte_t *pte;
+  pte_t *pte, *npte;
   uint pa, i, flags;
   char *mem;
 
   if((d = setupkvm()) == 0)
     return 0;
-  for(i = 0; i < sz; i += PGSIZE){
-    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0)
-      panic("copyuvm: pte should exist");
+  for(i = 0; i < KERNBASE; i += PGSIZE){
+    if(pgdir[PDX(i)] & PTE_PS){
+      if(copylarge(d, pgdir, i) < 0)
+        goto bad;
+      i += LPGSIZE - PGSIZE;
+      continue;
+    }
+    // Pages of demand-paged regions that the parent never
+    // touched are absent; the child faults them in itself.
+    if((pte = walkpgdir(pgdir, (void *) i, 0)) == 0){
+      i = PGADDR(PDX(i) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    if(*pte & PTE_SWAP){
+      // Parent and child share the slot until each
+      // reads the page back in.
+      if((npte = walkpgdir(d, (void*)i, 1)) == 0)
+        goto bad;
+      swapdup(PTE_ADDR(*pte) >> PTXSHIFT);
+      *npte = *pte;
+      continue;
+    }
     if(!(*pte & PTE_P))
-      panic("copyuvm: page not present");
+      continue;
     pa = PTE_ADDR(*pte);
     flags = PTE_FLAGS(*pte);
-    if((mem = kalloc()) == 0)
+    if(!(flags & PTE_W) || (flags & PTE_SHR)){
+      // Read-only pages (shared text, copy-on-write data)
+      // can be shared rather than copied; shared mappings
+      // must be.  The parent writes back its own dirty pages.
+      kref(P2V(pa));
+      if(mappages(d, (void*)i, PGSIZE, pa, flags & ~PTE_D) < 0){
+        kfree(P2V(pa));
+        goto bad;
+      }
+      continue;
+    }
+    if((mem = ualloc(0)) == 0)
       goto bad;
     memmove(mem, (char*)P2V(pa), PGSIZE);
-    if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0)
+    if(mappages(d, (void*)i, PGSIZE, V2P(mem), flags) < 0){
+      kfree(mem);
       goto bad;
+    }
   }
   return d;
 
@@ -350,10 +490,12 @@ uva2ka(pde_t *pgdir, char *uva)
   pte_t *pte;
 
   pte = walkpgdir(pgdir, uva, 0);
-  if((*pte & PTE_P) == 0)
+  if(pte == 0 || (*pte & PTE_P) == 0)
     return 0;
   if((*pte & PTE_U) == 0)
     return 0;
+  if(*pte & PTE_PS)
+    return (char*)P2V(PTE_ADDR(*pte)) + ((uint)uva & (LPGSIZE-1));
   return (char*)P2V(PTE_ADDR(*pte));
 }
 
@@ -384,7 +526,637 @@ copyout(pde_t *pgdir, uint va, void *p, uint len)
 }
 
 //PAGEBREAK!
-// Blank page.
+// Demand paging.
+//
+// exec() does not read a program into memory. It records each
+// loadable segment as a vma in the process and leaves its pages
+// unmapped; the first access to a page traps to pagefault(),
+// which reads just that page from the executable's inode.
+// mmap() regions work the same way, and live between the top
+// of the heap and KERNBASE.  Pages that have been paged out
+// to swap (see swap.c) are read back in the same way.
+
+// Page faults handled since boot, for meminfo().
+static struct {
+  uint minflt;      // served from memory
+  uint majflt;      // had to read from disk
+  uint cowflt;      // copy-on-write breaks
+} faults;
+
+// Return the region of p that contains va, or 0 if none.
+static struct vma*
+findvma(struct proc *p, uint va)
+{
+  struct vma *v;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->flags && va >= v->start && va < v->end)
+      return v;
+  return 0;
+}
+
+// Give p a private, writable copy of the copy-on-write page
+// mapped by pte.
+static int
+cowpage(struct proc *p, pte_t *pte)
+{
+  char *mem;
+  uint pa;
+
+  if((mem = ualloc(0)) == 0)
+    return -1;
+  pa = PTE_ADDR(*pte);
+  memmove(mem, P2V(pa), PGSIZE);
+  *pte = V2P(mem) | (PTE_FLAGS(*pte) & ~PTE_COW) | PTE_W;
+  kfree(P2V(pa));
+  lcr3(V2P(p->pgdir));  // flush the stale read-only TLB entry
+  return 0;
+}
+
+// Map the page at a, which lies in region v of p.
+// Pages of a shared file mapping, and pages lying entirely
+// within the file part of a private one, come from the page
+// cache (see pcache.c); the private ones are copy-on-write.
+// Returns 1 if the page was read from the file, 0 if not,
+// or -1 on failure.
+static int
+fillpage(struct proc *p, struct vma *v, uint a)
+{
+  char *mem;
+  uint n, perm;
+  int read;
+
+  // A kernel fault while already holding the inode would deadlock.
+  if(v->ip && holdingsleep(&v->ip->lock))
+    return -1;
+  perm = v->perm;
+  if(v->ip && a - v->start + PGSIZE <= v->filesz){
+    if((mem = pcpage(v->ip, v->off + (a - v->start), &read)) == 0)
+      return -1;
+    if(!(v->flags & MAP_SHARED) && (perm & PTE_W))
+      perm = (perm & ~PTE_W) | PTE_COW;
+  } else {
+    if((mem = ualloc(1)) == 0)
+      return -1;
+    read = 0;
+    if(a - v->start < v->filesz){
+      read = 1;
+      n = v->filesz - (a - v->start);
+      if(n > PGSIZE)
+        n = PGSIZE;
+      ilock(v->ip);
+      if(readi(v->ip, mem, v->off + (a - v->start), n) != n){
+        iunlock(v->ip);
+        kfree(mem);
+        return -1;
+      }
+      iunlock(v->ip);
+    }
+  }
+  if(mappages(p->pgdir, (char*)a, PGSIZE, V2P(mem), perm) < 0){
+    kfree(mem);
+    return -1;
+  }
+  return read;
+}
+
+// Read the page that pte says is in swap back into memory.
+static int
+swapin(pte_t *pte)
+{
+  char *mem;
+  uint slot, flags;
+
+  if((mem = ualloc(0)) == 0)
+    return -1;
+  slot = PTE_ADDR(*pte) >> PTXSHIFT;
+  swapread(slot, mem);
+  flags = PTE_FLAGS(*pte) & ~PTE_SWAP;
+  // Only unshared pages are paged out, so the copy
+  // read back in is private.
+  if(flags & PTE_COW)
+    flags = (flags & ~PTE_COW) | PTE_W;
+  *pte = V2P(mem) | flags | PTE_P | PTE_A;
+  swapfree(slot);
+  return 0;
+}
+
+// Handle a fault on va by process p: fill in an absent page of
+// a region or read back a paged-out one, and break copy-on-write
+// if the access is a write.  Returns 0 on success, -1 if va is
+// not mapped for the user or the access is not allowed.
+int
+pagefault(struct proc *p, uint va, int write)
+{
+  struct vma *v;
+  pte_t *pte;
+  uint a;
+  int busy, major, r;
+
+  // Allocating a page may page others out; not p's, which
+  // this may be looking at.
+  busy = p->vmbusy;
+  p->vmbusy = 1;
+  r = -1;
+  major = 0;
+  a = PGROUNDDOWN(va);
+  pte = walkpgdir(p->pgdir, (char*)a, 0);
+  if(pte && (*pte & PTE_SWAP)){
+    if(swapin(pte) < 0)
+      goto out;
+    major = 1;
+  } else if(pte == 0 || !(*pte & PTE_P)){
+    if((v = findvma(p, va)) == 0 || (major = fillpage(p, v, a)) < 0)
+      goto out;
+    pte = walkpgdir(p->pgdir, (char*)a, 0);
+  }
+  if(!(*pte & PTE_U))
+    ;  // not for the user, like the stack guard page
+  else if(!write || (*pte & PTE_W))
+    r = 0;
+  else if(*pte & PTE_COW){
+    if((r = cowpage(p, pte)) == 0){
+      p->cowflt++;
+      __sync_fetch_and_add(&faults.cowflt, 1);
+    }
+  }
+  if(r == 0){
+    if(major){
+      p->majflt++;
+      __sync_fetch_and_add(&faults.majflt, 1);
+    } else {
+      p->minflt++;
+      __sync_fetch_and_add(&faults.minflt, 1);
+    }
+  }
+out:
+  p->vmbusy = busy;
+  return r;
+}
+
+// Make sure the pages of p covering [va, va+n) are present,
+// and writable if write is set.  System calls use this on user
+// pointers before touching them, so that the kernel does not
+// fault while holding locks.  The pages stay put until the
+// system call returns: syscall() clears p->vmbusy.
+// Returns -1 if any part of the range is not valid user memory.
+int
+touchuvm(struct proc *p, uint va, uint n, int write)
+{
+  pte_t *pte;
+  uint a;
+
+  if(va >= KERNBASE || va + n > KERNBASE || va + n < va)
+    return -1;
+  p->vmbusy = 1;
+  for(a = PGROUNDDOWN(va); a < va + n; a += PGSIZE){
+    pte = walkpgdir(p->pgdir, (char*)a, 0);
+    if(pte && (*pte & (PTE_P|PTE_U)) == (PTE_P|PTE_U) &&
+       (!write || (*pte & PTE_W)))
+      continue;
+    if(pagefault(p, a, write) < 0)
+      return -1;
+  }
+  return 0;
+}
+
+// Does any region in vma[0..NVMA) overlap [start, end)?
+int
+vmaoverlap(struct vma *vma, uint start, uint end)
+{
+  struct vma *v;
+
+  for(v = vma; v < &vma[NVMA]; v++)
+    if(v->flags && v->start < end && v->end > start)
+      return 1;
+  return 0;
+}
+
+// Find len bytes of free address space for a new mapping,
+// aligned to align, as high as possible below KERNBASE.
+// Returns 0 if none.
+static uint
+vmaplace(struct proc *p, uint len, uint align)
+{
+  struct vma *v;
+  uint start, end;
+
+  end = KERNBASE;
+again:
+  if(end < len)
+    return 0;
+  start = (end - len) & ~(align - 1);
+  if(start < PGROUNDUP(p->sz))
+    return 0;
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->flags && v->start < start + len && v->end > start){
+      end = v->start;
+      goto again;
+    }
+  }
+  return start;
+}
+
+// Pick a free region slot of p and the address range for a
+// new mapping of len bytes (at addr if flags has MAP_FIXED).
+// The caller fills in the rest and sets flags last.
+static struct vma*
+vmaalloc(struct proc *p, uint addr, uint len, int flags)
+{
+  struct vma *v;
+  uint align;
+
+  align = (flags & MAP_HUGETLB) ? LPGSIZE : PGSIZE;
+  len = (len + align - 1) & ~(align - 1);
+  if(len == 0 || len >= KERNBASE)
+    return 0;
+  if(flags & MAP_FIXED){
+    if(addr % align != 0 || addr < PGROUNDUP(p->sz) ||
+       addr + len > KERNBASE || addr + len < addr ||
+       vmaoverlap(p->vma, addr, addr + len))
+      return 0;
+  } else if((addr = vmaplace(p, len, align)) == 0)
+    return 0;
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->flags == 0){
+      memset(v, 0, sizeof(*v));
+      v->start = addr;
+      v->end = addr + len;
+      return v;
+    }
+  }
+  return 0;
+}
+
+// Map the large page at physical address pa at va in pgdir.
+static int
+maplarge(pde_t *pgdir, uint va, uint pa, int perm)
+{
+  pde_t *pde;
+  pte_t *pgtab;
+  int i;
+
+  pde = &pgdir[PDX(va)];
+  if(*pde & PTE_P){
+    // Only an empty page table, left behind by mappings
+    // that have since been removed, can be replaced.
+    if(*pde & PTE_PS)
+      panic("maplarge: remap");
+    pgtab = (pte_t*)P2V(PTE_ADDR(*pde));
+    for(i = 0; i < NPTENTRIES; i++)
+      if(pgtab[i] & PTE_P)
+        return -1;
+    kfree((char*)pgtab);
+  }
+  *pde = pa | perm | PTE_PS | PTE_P;
+  return 0;
+}
+
+// Map len bytes of ip starting at offset off (or anonymous
+// memory if ip is 0) into p.  prot and flags are as for
+// mmap(); addr is used only with MAP_FIXED.
+// Returns the address of the mapping, or -1.
+int
+vmamap(struct proc *p, uint addr, uint len, int prot, int flags,
+       struct inode *ip, uint off)
+{
+  struct vma *nv;
+  char *mem;
+  uint a;
+
+  if(len == 0 || off % PGSIZE != 0)
+    return -1;
+  if(((flags & MAP_SHARED) != 0) == ((flags & MAP_PRIVATE) != 0))
+    return -1;
+  if((flags & MAP_HUGETLB) && ip)
+    return -1;
+  if(ip){
+    ilock(ip);
+    if(ip->type != T_FILE){
+      iunlock(ip);
+      return -1;
+    }
+    iunlock(ip);
+  }
+  if((nv = vmaalloc(p, addr, len, flags)) == 0)
+    return -1;
+  addr = nv->start;
+  len = nv->end - nv->start;
+  nv->off = off;
+  nv->filesz = ip ? len : 0;
+  nv->perm = PTE_U;
+  if(prot & PROT_WRITE)
+    nv->perm |= PTE_W;
+  if(flags & MAP_SHARED)
+    nv->perm |= PTE_SHR;
+
+  // Large pages are allocated up front, and so is shared
+  // anonymous memory, which has no file to fault pages in
+  // from; fork() then shares the pages.
+  if(flags & MAP_HUGETLB){
+    for(a = addr; a < addr + len; a += LPGSIZE){
+      if((mem = lpalloc()) == 0 ||
+         maplarge(p->pgdir, a, V2P(mem), nv->perm) < 0){
+        if(mem)
+          lpfree(mem);
+        goto bad;
+      }
+    }
+  } else if(ip == 0 && (flags & MAP_SHARED)){
+    for(a = addr; a < addr + len; a += PGSIZE){
+      if((mem = ualloc(1)) == 0)
+        goto bad;
+      if(mappages(p->pgdir, (char*)a, PGSIZE, V2P(mem), nv->perm) < 0){
+        kfree(mem);
+        goto bad;
+      }
+    }
+  }
+  if(ip){
+    nv->ip = idup(ip);
+    pcref(ip);
+  } else
+    nv->ip = 0;
+  nv->flags = flags & (MAP_SHARED|MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB);
+  return addr;
+
+bad:
+  deallocuvm(p->pgdir, addr + len, addr);
+  return -1;
+}
+
+// Attach shared memory segment s, of len bytes, to p.
+// The caller has taken a reference to s for the new region.
+// Returns the address of the mapping, or -1.
+int
+vmashm(struct proc *p, struct shm *s, uint len)
+{
+  struct vma *nv;
+  char *mem;
+  uint a;
+
+  if((nv = vmaalloc(p, 0, len, 0)) == 0)
+    return -1;
+  nv->perm = PTE_U|PTE_W|PTE_SHR;
+  for(a = nv->start; a < nv->end; a += PGSIZE){
+    mem = shmpage(s, (a - nv->start) / PGSIZE);
+    if(mappages(p->pgdir, (char*)a, PGSIZE, V2P(mem), nv->perm) < 0){
+      kfree(mem);
+      deallocuvm(p->pgdir, a, nv->start);
+      return -1;
+    }
+  }
+  nv->shm = s;
+  nv->flags = MAP_SHARED|MAP_ANONYMOUS;
+  return nv->start;
+}
+
+// Detach the shared memory segment attached at addr from p.
+int
+vmashmdt(struct proc *p, uint addr)
+{
+  struct vma *v;
+
+  if((v = findvma(p, addr)) == 0 || v->shm == 0 || v->start != addr)
+    return -1;
+  return vmaunmap(p, v->start, v->end - v->start);
+}
+
+// Write the dirty pages of shared file mapping v in
+// [start, end) back to the file.  Like filewrite(), split
+// the writes into transactions that fit in the log.
+// Writes never extend the file.
+static void
+vmasync(pde_t *pgdir, struct vma *v, uint start, uint end)
+{
+  int max = MAXOPWRITE;
+  pte_t *pte;
+  char *mem;
+  uint a, off, i, n;
+
+  for(a = start; a < end; a += PGSIZE){
+    if((pte = walkpgdir(pgdir, (char*)a, 0)) == 0 ||
+       (*pte & (PTE_P|PTE_D)) != (PTE_P|PTE_D))
+      continue;
+    mem = P2V(PTE_ADDR(*pte));
+    off = v->off + (a - v->start);
+    for(i = 0; i < PGSIZE; i += n){
+      n = PGSIZE - i;
+      if(n > max)
+        n = max;
+      begin_opdata(OP_WRITE, (n + BSIZE-1)/BSIZE + 1);
+      ilock(v->ip);
+      if(off + i < v->ip->size){
+        if(n > v->ip->size - (off + i))
+          n = v->ip->size - (off + i);
+        writei(v->ip, mem + i, off + i, n);
+      } else
+        n = PGSIZE - i;
+      iunlock(v->ip);
+      end_op();
+    }
+    *pte &= ~PTE_D;
+  }
+}
+
+// Drop region v of a process with page table pgdir.
+// Must not be called from inside a transaction.
+static void
+vmadrop(pde_t *pgdir, struct vma *v)
+{
+  if(v->ip){
+    if(pgdir && (v->flags & MAP_SHARED))
+      vmasync(pgdir, v, v->start, v->end);
+    begin_op(OP_IPUT);
+    pcput(v->ip);
+    iput(v->ip);
+    end_op();
+  }
+  if(v->shm)
+    shmput(v->shm);
+  v->ip = 0;
+  v->shm = 0;
+  v->flags = 0;
+}
+
+// Remove the mappings in [addr, addr+len) of p, which must lie
+// above the heap.  A region that is only partly covered keeps
+// the rest, and may be split in two.  Returns 0 or -1.
+int
+vmaunmap(struct proc *p, uint addr, uint len)
+{
+  struct vma *v, *nv;
+  uint end, s, e;
+
+  if(addr % PGSIZE != 0 || addr < PGROUNDUP(p->sz))
+    return -1;
+  end = PGROUNDUP(addr + len);
+  if(len == 0 || end > KERNBASE || end <= addr)
+    return -1;
+
+  // Splitting a region needs a free slot, and large pages
+  // can only be unmapped whole; check before changing anything.
+  nv = 0;
+  for(v = p->vma; v < &p->vma[NVMA]; v++)
+    if(v->flags == 0)
+      nv = v;
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->flags == 0 || v->start >= end || v->end <= addr)
+      continue;
+    s = v->start > addr ? v->start : addr;
+    e = v->end < end ? v->end : end;
+    if(v->start < s && v->end > e && nv == 0)
+      return -1;
+    if((v->flags & MAP_HUGETLB) && (s % LPGSIZE || e % LPGSIZE))
+      return -1;
+  }
+
+  for(v = p->vma; v < &p->vma[NVMA]; v++){
+    if(v->flags == 0 || v->start >= end || v->end <= addr)
+      continue;
+    s = v->start > addr ? v->start : addr;
+    e = v->end < end ? v->end : end;
+    if(v->ip && (v->flags & MAP_SHARED))
+      vmasync(p->pgdir, v, s, e);
+    deallocuvm(p->pgdir, e, s);
+    if(s == v->start && e == v->end){
+      vmadrop(0, v);
+    } else if(s == v->start){
+      v->filesz = v->filesz > e - s ? v->filesz - (e - s) : 0;
+      v->off += e - s;
+      v->start = e;
+    } else if(e == v->end){
+      if(v->filesz > s - v->start)
+        v->filesz = s - v->start;
+      v->end = s;
+    } else {
+      *nv = *v;
+      nv->start = e;
+      nv->off += e - v->start;
+      nv->filesz = v->filesz > e - v->start ? v->filesz - (e - v->start) : 0;
+      if(nv->ip){
+        idup(nv->ip);
+        pcref(nv->ip);
+      }
+      if(nv->shm)
+        shmdup(nv->shm);
+      v->end = s;
+    }
+  }
+  lcr3(V2P(p->pgdir));
+  return 0;
+}
+
+// Advance the clock hand *va over the user pages of pgdir,
+// looking for one to page out to swap slot.  Pages used since
+// the hand last went by (PTE_A set) get a second chance.
+// Shared pages, large pages and pages mapped more than once
+// are left alone.  Returns the page, whose PTE now refers to
+// slot, or 0 if the hand reached KERNBASE.
+// Called by swapvictim() with ptable.lock held.
+char*
+vmclock(pde_t *pgdir, uint *va, uint slot)
+{
+  pte_t *pte;
+  char *mem;
+  uint a;
+
+  for(a = *va; a < KERNBASE; a += PGSIZE){
+    if((pgdir[PDX(a)] & (PTE_P|PTE_PS)) != PTE_P){
+      a = PGADDR(PDX(a) + 1, 0, 0) - PGSIZE;
+      continue;
+    }
+    pte = walkpgdir(pgdir, (char*)a, 0);
+    if((*pte & (PTE_P|PTE_U)) != (PTE_P|PTE_U) || (*pte & PTE_SHR))
+      continue;
+    mem = P2V(PTE_ADDR(*pte));
+    if(krefcount(mem) != 1)
+      continue;
+    if(*pte & PTE_A){
+      *pte &= ~PTE_A;
+      continue;
+    }
+    *pte = slot << PTXSHIFT | (PTE_FLAGS(*pte) & ~(PTE_P|PTE_D)) | PTE_SWAP;
+    *va = a + PGSIZE;
+    return mem;
+  }
+  *va = KERNBASE;
+  return 0;
+}
+
+// Count the user memory of pgdir: *rss gets the resident
+// pages, *swapped those paged out, and *pt the page-table
+// pages, including the directory.  Only looks, so it is safe
+// on the page table of a process running elsewhere; the
+// counts are a snapshot.
+void
+vmusage(pde_t *pgdir, uint *rss, uint *swapped, uint *pt)
+{
+  pte_t *pgtab;
+  uint i, j;
+
+  *rss = *swapped = 0;
+  *pt = 1;
+  for(i = 0; i < PDX(KERNBASE); i++){
+    if(!(pgdir[i] & PTE_P) || PTE_ADDR(pgdir[i]) >= PHYSTOP)
+      continue;
+    if(pgdir[i] & PTE_PS){
+      *rss += NPTENTRIES;
+      continue;
+    }
+    (*pt)++;
+    pgtab = (pte_t*)P2V(PTE_ADDR(pgdir[i]));
+    for(j = 0; j < NPTENTRIES; j++){
+      if(pgtab[j] & PTE_P)
+        (*rss)++;
+      else if(pgtab[j] & PTE_SWAP)
+        (*swapped)++;
+    }
+  }
+}
+
+// Fill in the page fault counts of m.
+void
+vmstat(struct meminfo *m)
+{
+  m->minflt = faults.minflt;
+  m->majflt = faults.majflt;
+  m->cowflt = faults.cowflt;
+}
+
+// Give each region in dst its own reference to the file or
+// shared memory segment of the corresponding region in src.
+// Used by fork(); copyuvm() has already dealt with the pages.
+void
+vmadup(struct vma *dst, struct vma *src)
+{
+  int i;
+
+  for(i = 0; i < NVMA; i++){
+    dst[i] = src[i];
+    if(dst[i].ip){
+      idup(dst[i].ip);
+      pcref(dst[i].ip);
+    }
+    if(dst[i].shm)
+      shmdup(dst[i].shm);
+  }
+}
+
+// Release the regions in vma[0..NVMA), writing shared file
+// pages that are dirty in pgdir back first.
+// Must not be called from inside a transaction.
+void
+vmafree(pde_t *pgdir, struct vma *vma)
+{
+  struct vma *v;
+
+  for(v = vma; v < &vma[NVMA]; v++)
+    if(v->flags)
+      vmadrop(pgdir, v);
+}
+
 //PAGEBREAK!
 // Blank page.
 //PAGEBREAK!